@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "perf_counters.h"
+
+// Keeps |value| alive so the compiler can't drop the work producing it:
+// the value escapes to an empty asm statement which may read any memory.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+#if defined(_MSC_VER)
+    // MSVC has no inline asm on x64, a volatile read of the address and a
+    // compiler barrier keep the value.
+    const volatile T* volatile escape = &value;
+    (void)escape;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "g"(&value) : "memory");
+#endif
+}
+
+inline uint64_t NowNanoseconds() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Prints the counters which advanced from |start| to |end| per operation.
+inline void ReportPerfCounters(const PerfCounterGroup& group, const PerfSample& start,
+                               const PerfSample& end, uint64_t operations) {
+    if (!group.Available() || operations == 0) {
+        return;
+    }
+    std::cout << "   ";
+    for (int i = 0; i < kPerfEventCount; ++i) {
+        if (group.EventAvailable(static_cast<PerfEvent>(i))) {
+            std::cout << " " << PerfEventName(static_cast<PerfEvent>(i)) << "/op="
+                << static_cast<double>(end.values[i] - start.values[i]) / operations;
+        }
+    }
+    const uint64_t cycles = end.values[kPerfCycles] - start.values[kPerfCycles];
+    if (cycles > 0 && group.EventAvailable(kPerfInstructions)) {
+        std::cout << " ipc=" << static_cast<double>(
+            end.values[kPerfInstructions] - start.values[kPerfInstructions]) / cycles;
+    }
+    std::cout << std::endl;
+}
+
+// Runs |function| |iterations| times and reports the mean cost of one call,
+// and the hardware counters per call where perf_event_open is allowed.
+template <typename Function>
+double RunBenchmark(const std::string& name, uint64_t iterations, Function function) {
+    const PerfCounterGroup perf_counters;
+    const PerfSample perf_start = perf_counters.Read();
+    const uint64_t start = NowNanoseconds();
+    for (uint64_t i = 0; i < iterations; ++i) {
+        function(i);
+    }
+    const uint64_t end = NowNanoseconds();
+    const PerfSample perf_end = perf_counters.Read();
+    const double nanoseconds_per_call =
+        static_cast<double>(end - start) / static_cast<double>(iterations);
+    std::cout << name << ": " << nanoseconds_per_call << " ns/op" << std::endl;
+    ReportPerfCounters(perf_counters, perf_start, perf_end, iterations);
+    return nanoseconds_per_call;
+}
+
+// Percentile of already sorted samples, |percentile| is in [0, 100].
+inline uint64_t Percentile(const std::vector<uint64_t>& sorted_samples, double percentile) {
+    if (sorted_samples.empty()) {
+        return 0;
+    }
+    const size_t index = static_cast<size_t>(
+        percentile / 100.0 * static_cast<double>(sorted_samples.size() - 1));
+    return sorted_samples[std::min(index, sorted_samples.size() - 1)];
+}
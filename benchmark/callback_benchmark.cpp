@@ -0,0 +1,82 @@
+#include "callback_benchmark.h"
+
+#include <functional>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+
+#include "allocation_tracker.h"
+#include "benchmark_util.h"
+#include "inplace_function.h"
+
+namespace {
+    constexpr uint64_t kPackets = 10000000;
+    // One packet at 10M packets per second.
+    constexpr double kBudgetNanoseconds = 100;
+    constexpr size_t kPacketSize = 64;
+
+    struct PacketCounters {
+        uint64_t packets;
+        uint64_t bytes;
+        uint64_t first_bytes;
+    };
+
+    // The packet loop of ReceiveEngine, |callback| is called directly.
+    template <typename Callback>
+    void DeliverPacket(Callback& callback, const std::string& ip, const uint8_t* data,
+                       size_t size) {
+        callback(ip, data, size);
+    }
+
+    template <typename Callback>
+    void RunDelivery(const std::string& name, Callback callback) {
+        const std::string ip = "192.168.0.10";
+        uint8_t packet[kPacketSize] = { 1 };
+        AllocationScope allocation_scope;
+        const double nanoseconds = RunBenchmark(name, kPackets, [&](uint64_t i) {
+            packet[0] = static_cast<uint8_t>(i);
+            DeliverPacket(callback, ip, packet, kPacketSize - i % 8);
+        });
+        std::cout << "    " << (nanoseconds <= kBudgetNanoseconds ? "within" : "over")
+            << " the 10M packets/s budget, allocations "
+            << allocation_scope.Counts().allocations << std::endl;
+    }
+}
+
+void BenchmarkCallbacks() {
+    using PacketCallback = void(const std::string&, const uint8_t*, size_t);
+    PacketCounters counters = {};
+    uint64_t limit = kPackets;
+    uint64_t dropped = 0;
+    // Three references, more than libstdc++ keeps inside a std::function
+    // and within the 32 bytes of the InplaceFunction.
+    auto consumer = [&counters, &limit, &dropped](const std::string& ip,
+                                                  const uint8_t* data, size_t size) {
+        if (counters.packets >= limit) {
+            ++dropped;
+            return;
+        }
+        ++counters.packets;
+        counters.bytes += size + ip.size();
+        counters.first_bytes += data[0];
+    };
+
+    // Every run starts from empty counters, so each delivers all its packets
+    // instead of dropping what the runs before have used up.
+    auto reset = [&]() {
+        DoNotOptimize(counters.bytes + counters.first_bytes + dropped);
+        counters = PacketCounters();
+        limit = kPackets;
+        dropped = 0;
+    };
+    RunDelivery("std::function delivery", std::function<PacketCallback>(consumer));
+    reset();
+    RunDelivery("InplaceFunction delivery", InplaceFunction<PacketCallback, 32>(consumer));
+    reset();
+    RunDelivery("Template parameter delivery", consumer);
+    DoNotOptimize(counters.bytes + counters.first_bytes + dropped);
+    if (dropped != 0) {
+        std::cout << "    " << dropped << " packets dropped, the runs aren't comparable"
+            << std::endl;
+    }
+}
@@ -0,0 +1,56 @@
+// LOG_INFO is compiled out of this file, LOG_WARN is disabled at runtime.
+#define LOG_COMPILE_LEVEL LOG_LEVEL_WARN
+
+#include "log_level_benchmark.h"
+
+#include <iostream>
+#include <string>
+
+#include "benchmark_util.h"
+#include "logger.h"
+
+namespace {
+    constexpr uint64_t kIterations = 100000000;
+
+    uint64_t evaluated_arguments = 0;
+
+    // Stands for a formatting argument which is expensive to produce.
+    std::string ExpensiveArgument(uint64_t value) {
+        ++evaluated_arguments;
+        return std::to_string(value);
+    }
+
+    uint64_t Mix(uint64_t value) {
+        return value * 0x9E3779B97F4A7C15ull ^ (value >> 29);
+    }
+}
+
+void BenchmarkLogLevel() {
+    logger::SetLogLevel(LOG_LEVEL_ERROR);
+
+    uint64_t sum = 0;
+    const double baseline = RunBenchmark("Loop without log", kIterations,
+        [&sum](uint64_t i) {
+            sum += Mix(i);
+            DoNotOptimize(sum);
+        });
+
+    const double compiled_out = RunBenchmark("Loop with compiled out LOG_INFO", kIterations,
+        [&sum](uint64_t i) {
+            sum += Mix(i);
+            LOG_INFO << "Ip detected is: " << ExpensiveArgument(sum) << ENDLINE;
+            DoNotOptimize(sum);
+        });
+
+    const double runtime_disabled = RunBenchmark("Loop with runtime disabled LOG_WARN",
+        kIterations, [&sum](uint64_t i) {
+            sum += Mix(i);
+            LOG_WARN << "Receive data error: " << ExpensiveArgument(sum) << ENDLINE;
+            DoNotOptimize(sum);
+        });
+
+    logger::SetLogLevel(LOG_LEVEL_INFO);
+    std::cout << "Compiled out overhead: " << compiled_out - baseline
+        << " ns/op, runtime disabled overhead: " << runtime_disabled - baseline
+        << " ns/op, arguments evaluated: " << evaluated_arguments << std::endl;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Compares a hot loop with and without a compiled out LOG_INFO statement and
+// a LOG_WARN statement disabled at runtime.
+void BenchmarkLogLevel();
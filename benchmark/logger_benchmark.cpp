@@ -0,0 +1,205 @@
+#include "logger_benchmark.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async_logger.h"
+#include "benchmark_util.h"
+#include "binary_logger.h"
+#include "mmap_file_sink.h"
+#include "tsc_clock.h"
+
+namespace {
+    // More than a ring holds, so a producer outrunning the writer drops.
+    constexpr uint64_t kCallsPerThread = 100000;
+    // At least kMinMaxThreads producers even on fewer cores, contention on
+    // an oversubscribed host is worth seeing too.
+    constexpr unsigned int kMinMaxThreads = 4;
+    constexpr unsigned int kMaxThreads = 8;
+    constexpr size_t kAddressCount = 64;
+
+    // Lines of one producer thread: the detected local ip, the sender and
+    // the received bytes.
+    using LogFunction = std::function<void(unsigned int thread, uint64_t call)>;
+
+    std::vector<std::string> local_ips;
+    std::vector<uint32_t> sender_ips;
+    std::vector<std::string> sender_texts;
+
+    void InitAddresses() {
+        for (size_t i = 0; i < kAddressCount; ++i) {
+            local_ips.push_back("192.168." + std::to_string(i / 8) + "." +
+                std::to_string(10 + i));
+            const uint32_t sender = 0x0A000000u | static_cast<uint32_t>(i * 37 + 1);
+            sender_ips.push_back(sender);
+            sender_texts.push_back("10." + std::to_string((sender >> 16) & 0xFF) + "." +
+                std::to_string((sender >> 8) & 0xFF) + "." + std::to_string(sender & 0xFF));
+        }
+    }
+
+    // Discards the lines, isolates the producer side of the async backend.
+    class NullSink : public logger::LogSink {
+    public:
+        bool Write(const char*, size_t) override {
+            return true;
+        }
+    };
+
+    std::vector<unsigned int> ThreadCounts() {
+        const unsigned int max_threads = std::min(
+            std::max(kMinMaxThreads, std::thread::hardware_concurrency()), kMaxThreads);
+        std::vector<unsigned int> counts;
+        for (unsigned int count = 1; count < max_threads; count *= 2) {
+            counts.push_back(count);
+        }
+        counts.push_back(max_threads);
+        return counts;
+    }
+
+    // |dropped| returns the backend's total of dropped lines, |flush| waits
+    // on a producer thread until its lines are written. Returns the report.
+    std::string RunLoggerBenchmark(const std::string& backend, unsigned int thread_count,
+                                   const LogFunction& log,
+                                   const std::function<uint64_t()>& dropped,
+                                   const std::function<void()>& flush) {
+        const logger::TscClock& clock = logger::TscClock::Instance();
+        std::vector<std::vector<uint64_t>> latencies(thread_count);
+        std::atomic<unsigned int> ready(0);
+        std::atomic<bool> go(false);
+        const uint64_t dropped_before = dropped();
+
+        std::vector<std::thread> threads;
+        for (unsigned int t = 0; t < thread_count; ++t) {
+            threads.push_back(std::thread([&, t]() {
+                std::vector<uint64_t>& samples = latencies[t];
+                samples.reserve(kCallsPerThread);
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) {
+                }
+                for (uint64_t i = 0; i < kCallsPerThread; ++i) {
+                    const uint64_t start = logger::TscClock::ReadTicks();
+                    log(t, i);
+                    samples.push_back(logger::TscClock::ReadTicks() - start);
+                }
+                flush();
+            }));
+        }
+        while (ready.load() != thread_count) {
+            std::this_thread::yield();
+        }
+        const uint64_t start = NowNanoseconds();
+        go.store(true, std::memory_order_release);
+        for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+            iter->join();
+        }
+        const double elapsed_ns = static_cast<double>(NowNanoseconds() - start);
+
+        std::vector<uint64_t> all;
+        for (auto iter = latencies.begin(); iter != latencies.end(); ++iter) {
+            all.insert(all.end(), iter->begin(), iter->end());
+        }
+        std::sort(all.begin(), all.end());
+        const double ticks_per_ns = clock.TicksPerNanosecond();
+        auto ns = [ticks_per_ns](uint64_t ticks) {
+            return static_cast<uint64_t>(static_cast<double>(ticks) / ticks_per_ns);
+        };
+        const double calls = static_cast<double>(all.size());
+        std::ostringstream report;
+        report << std::left << std::setw(8) << backend << " threads " << thread_count
+            << ": p50 " << ns(Percentile(all, 50)) << " ns, p99 " << ns(Percentile(all, 99))
+            << " ns, p99.9 " << ns(Percentile(all, 99.9)) << " ns, max " << ns(all.back())
+            << " ns, " << static_cast<uint64_t>(calls / elapsed_ns * 1e6) << " K calls/s"
+            << ", dropped " << dropped() - dropped_before;
+        return report.str();
+    }
+
+    void BenchmarkConsole(const std::vector<unsigned int>& thread_counts) {
+        // Redirected to a file, the terminal's speed would dominate otherwise.
+        std::ofstream file("logger_benchmark.console.log");
+        for (size_t i = 0; i < thread_counts.size(); ++i) {
+            std::streambuf* console = std::cout.rdbuf(file.rdbuf());
+            const std::string report = RunLoggerBenchmark("console", thread_counts[i],
+                [](unsigned int thread, uint64_t call) {
+                    const size_t index = (thread + call) % kAddressCount;
+                    std::cout << "Ip detected is: " << local_ips[index] << ", sender "
+                        << sender_texts[index] << ", " << 64 + call % 1400 << " bytes"
+                        << std::endl;
+                },
+                []() { return uint64_t(0); }, []() {});
+            std::cout.rdbuf(console);
+            std::cout << report << std::endl;
+        }
+    }
+
+    void BenchmarkAsync(const std::vector<unsigned int>& thread_counts,
+                        const std::string& backend, logger::LogSink* sink,
+                        const std::function<uint64_t()>& sink_dropped) {
+        logger::AsyncLogger& async_logger = logger::AsyncLogger::Instance();
+        async_logger.SetSink(sink);
+        for (size_t i = 0; i < thread_counts.size(); ++i) {
+            std::cout << RunLoggerBenchmark(backend, thread_counts[i],
+                [](unsigned int thread, uint64_t call) {
+                    const size_t index = (thread + call) % kAddressCount;
+                    logger::LogLine(logger::kLogInfo) << "Ip detected is: " << local_ips[index]
+                        << ", sender " << sender_texts[index] << ", " << 64 + call % 1400
+                        << " bytes";
+                },
+                [&async_logger, &sink_dropped]() {
+                    return async_logger.DroppedCount() + sink_dropped();
+                },
+                [&async_logger]() { async_logger.Flush(); }) << std::endl;
+        }
+        async_logger.SetSink(nullptr);
+    }
+
+    void BenchmarkBinary(const std::vector<unsigned int>& thread_counts) {
+        logger::BinaryLogger& binary_logger = logger::BinaryLogger::Instance();
+        if (!binary_logger.Open("logger_benchmark.blog")) {
+            std::cout << "binary: can't open logger_benchmark.blog" << std::endl;
+            return;
+        }
+        for (size_t i = 0; i < thread_counts.size(); ++i) {
+            std::cout << RunLoggerBenchmark("binary", thread_counts[i],
+                [](unsigned int thread, uint64_t call) {
+                    const size_t index = (thread + call) % kAddressCount;
+                    LOG_BINARY(LOG_LEVEL_INFO, "Ip detected is: {}, sender {}, {} bytes",
+                        local_ips[index], logger::IpV4(sender_ips[index]), 64 + call % 1400);
+                },
+                [&binary_logger]() { return binary_logger.DroppedCount(); },
+                []() {}) << std::endl;
+        }
+    }
+}
+
+void BenchmarkLoggers() {
+    InitAddresses();
+    const std::vector<unsigned int> thread_counts = ThreadCounts();
+
+    BenchmarkConsole(thread_counts);
+
+    NullSink null_sink;
+    BenchmarkAsync(thread_counts, "async", &null_sink, []() { return uint64_t(0); });
+
+    BenchmarkBinary(thread_counts);
+
+    logger::MmapFileSinkOptions options;
+    options.base_path = "logger_benchmark";
+    logger::MmapFileSink mmap_sink(options);
+    if (mmap_sink.Open()) {
+        BenchmarkAsync(thread_counts, "mmap", &mmap_sink,
+            [&mmap_sink]() { return mmap_sink.DroppedCount(); });
+        mmap_sink.Close();
+    }
+    else {
+        std::cout << "mmap: can't create logger_benchmark segments" << std::endl;
+    }
+}
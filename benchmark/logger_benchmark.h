@@ -0,0 +1,6 @@
+#pragma once
+
+// Measures the per call latency percentiles, the throughput and the dropped
+// lines of the console, async, binary and memory mapped file backends with
+// 1 to N producer threads logging IpDetector style lines.
+void BenchmarkLoggers();
@@ -0,0 +1,18 @@
+#include "callback_benchmark.h"
+#include "log_level_benchmark.h"
+#include "logger_benchmark.h"
+#include "publish_benchmark.h"
+#include "receive_benchmark.h"
+
+#include <stdlib.h>
+
+
+int main() {
+    BenchmarkLogLevel();
+    BenchmarkLoggers();
+    BenchmarkReceive();
+    BenchmarkCallbacks();
+    BenchmarkPublish();
+
+    system("pause");
+}
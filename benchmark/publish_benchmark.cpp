@@ -0,0 +1,79 @@
+#include "publish_benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark_util.h"
+#include "multicast_publisher.h"
+#include "paced_publisher.h"
+#include "tsc_clock.h"
+
+namespace {
+    constexpr int kBursts = 2000;
+    constexpr size_t kBurstPackets = 256;
+    // Fits a 1400 byte mtu, so every packet can be a UDP segment.
+    constexpr size_t kPacketSize = 1000;
+    constexpr int kDeadlines = 2000;
+    // A packet at 20K packets per second.
+    constexpr uint64_t kPacingIntervalNs = 50000;
+
+    void RunPublish(const std::string& name, bool batching, bool segmentation) {
+        MulticastPublisherOptions options;
+        options.loopback = true;
+        options.batching = batching;
+        options.segmentation = segmentation;
+        // Half a gigabyte per run, which stays on this host.
+        MulticastPublisher publisher("239.0.0.101", 6668, options);
+        if (!publisher.OpenInterface("127.0.0.1")) {
+            std::cout << name << ": can't publish on loopback" << std::endl;
+            return;
+        }
+
+        const std::vector<uint8_t> payload(kPacketSize, 0xAB);
+        const std::vector<boost::asio::const_buffer> packets(kBurstPackets,
+            boost::asio::const_buffer(payload.data(), payload.size()));
+        for (int i = 0; i < kBursts; ++i) {
+            publisher.Send(packets);
+        }
+        std::cout << name << ": " << MulticastPublisher::FormatStats(publisher.Stats())
+            << std::endl;
+    }
+
+    template <typename Wait>
+    void RunPacingDeadlines(const std::string& name, Wait wait) {
+        const logger::TscClock& clock = logger::TscClock::Instance();
+        std::vector<uint64_t> late_ns;
+        late_ns.reserve(kDeadlines);
+        for (int i = 0; i < kDeadlines; ++i) {
+            const uint64_t deadline = clock.NowNanoseconds() + kPacingIntervalNs;
+            wait(deadline);
+            const uint64_t now = clock.NowNanoseconds();
+            late_ns.push_back(now > deadline ? now - deadline : 0);
+        }
+        std::sort(late_ns.begin(), late_ns.end());
+        std::cout << name << ": late p50=" << Percentile(late_ns, 50) << " ns p99="
+            << Percentile(late_ns, 99) << " ns max=" << late_ns.back() << " ns" << std::endl;
+    }
+}
+
+void BenchmarkPublish() {
+    RunPublish("Publish, sendto", false, false);
+    RunPublish("Publish, sendmmsg", true, false);
+    RunPublish("Publish, sendmmsg with UDP_SEGMENT", true, true);
+
+    RunPacingDeadlines("Pacing, sleep_for", [](uint64_t deadline) {
+        const uint64_t now = logger::TscClock::Instance().NowNanoseconds();
+        if (deadline > now) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(deadline - now));
+        }
+    });
+    const HybridTimer timer(PacingOptions().spin_ns);
+    RunPacingDeadlines("Pacing, HybridTimer", [&](uint64_t deadline) {
+        timer.SleepUntil(deadline);
+    });
+}
@@ -0,0 +1,234 @@
+#include "receive_benchmark.h"
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <functional>
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+#include "allocation_tracker.h"
+#include "benchmark_util.h"
+#include "handler_memory.h"
+#include "receive_engine.h"
+
+namespace {
+    constexpr uint64_t kPackets = 100000;
+    constexpr uint64_t kBursts = 10000;
+    constexpr size_t kBurstPackets = 32;
+    constexpr size_t kPacketSize = 64;
+    constexpr size_t kBufferLen = 1500;
+
+    // The receive cycle of IpDetector without the detection itself. With
+    // |handler_memory| the operation comes from a HandlerMemory and the
+    // handler refers to the address, as IpDetector does now, otherwise it
+    // is allocated by asio and copies the address.
+    class LoopbackReceiver {
+    public:
+        LoopbackReceiver(boost::asio::io_service& io_service,
+                         std::function<void(const std::string&)> callback,
+                         const std::string& ip, bool handler_memory)
+            : socket_(io_service, boost::asio::ip::udp::endpoint(
+                boost::asio::ip::address_v4::loopback(), 0)),
+            callback_(std::move(callback)),
+            ip_(ip),
+            use_handler_memory_(handler_memory) {
+        }
+
+        boost::asio::ip::udp::endpoint LocalEndpoint() const {
+            return socket_.local_endpoint();
+        }
+
+        void DoAsyncReceive() {
+            if (use_handler_memory_) {
+                socket_.async_receive_from(boost::asio::buffer(buffer_, kBufferLen),
+                    sender_endpoint_, MakeCustomAllocHandler(handler_memory_,
+                        boost::bind(&LoopbackReceiver::ReceiveHandler, this,
+                            boost::asio::placeholders::error,
+                            boost::asio::placeholders::bytes_transferred,
+                            boost::cref(ip_))));
+                return;
+            }
+            socket_.async_receive_from(boost::asio::buffer(buffer_, kBufferLen), sender_endpoint_,
+                boost::bind(&LoopbackReceiver::ReceiveHandler, this,
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred,
+                    ip_));
+        }
+
+    private:
+        void ReceiveHandler(const boost::system::error_code& error,
+                            std::size_t bytes_transferred,
+                            const std::string& ip) {
+            if (error) {
+                return;
+            }
+            if (bytes_transferred > 0) {
+                callback_(ip);
+            }
+            DoAsyncReceive();
+        }
+
+    private:
+        boost::asio::ip::udp::socket socket_;
+        std::function<void(const std::string&)> callback_;
+        std::string ip_;
+        bool use_handler_memory_;
+        HandlerMemory handler_memory_;
+        boost::asio::ip::udp::endpoint sender_endpoint_;
+        uint8_t buffer_[kBufferLen];
+    };
+}
+
+namespace {
+    // The handler memory and ReceiveEngine cycles must not allocate once
+    // running, a regression fails the whole run rather than a number.
+    void RequireNoAllocations(const std::string& name, const AllocationCounts& counts) {
+        if (counts.allocations == 0) {
+            return;
+        }
+        std::cerr << name << ": " << counts.allocations << " allocations in the receive cycle"
+            << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    void RunReceiveBenchmark(const std::string& name, const std::string& ip,
+                             bool handler_memory) {
+        boost::asio::io_service io_service;
+        uint64_t received = 0;
+        LoopbackReceiver receiver(io_service, [&received](const std::string& ip) {
+            received += ip.size();
+        }, ip, handler_memory);
+        boost::asio::ip::udp::socket sender(io_service, boost::asio::ip::udp::v4());
+        const boost::asio::ip::udp::endpoint destination = receiver.LocalEndpoint();
+        const char payload[kPacketSize] = {};
+        receiver.DoAsyncReceive();
+
+        // One packet at a time, so none is dropped and every iteration runs
+        // one whole receive cycle on this thread.
+        AllocationScope allocation_scope;
+        RunBenchmark(name, kPackets, [&](uint64_t) {
+            sender.send_to(boost::asio::buffer(payload, kPacketSize), destination);
+            io_service.run_one();
+        });
+        const AllocationCounts counts = allocation_scope.Counts();
+        DoNotOptimize(received);
+
+        if (!AllocationTracker::Enabled()) {
+            std::cout << "    allocations not counted, build with TRACK_ALLOCATIONS" << std::endl;
+            return;
+        }
+        std::cout << "    allocations/packet=" << static_cast<double>(counts.allocations) / kPackets
+            << " bytes/packet=" << static_cast<double>(counts.bytes) / kPackets << std::endl;
+        if (handler_memory) {
+            RequireNoAllocations(name, counts);
+        }
+    }
+}
+
+namespace {
+    void RunReceiveEngineBenchmark(const std::string& name, const std::string& ip) {
+        boost::asio::io_service io_service;
+        uint64_t received = 0;
+        auto engine = MakeReceiveEngine([&received](const std::string& interface_ip,
+                                                    const uint8_t*, size_t size) {
+            received += interface_ip.size() + size;
+            return true;
+        });
+        boost::asio::ip::udp::socket socket(io_service, boost::asio::ip::udp::endpoint(
+            boost::asio::ip::address_v4::loopback(), 0));
+        const boost::asio::ip::udp::endpoint destination = socket.local_endpoint();
+        engine.AddSocket(ip, std::move(socket));
+        boost::asio::ip::udp::socket sender(io_service, boost::asio::ip::udp::v4());
+        const char payload[kPacketSize] = {};
+        engine.Start();
+
+        AllocationScope allocation_scope;
+        RunBenchmark(name, kPackets, [&](uint64_t) {
+            sender.send_to(boost::asio::buffer(payload, kPacketSize), destination);
+            io_service.run_one();
+        });
+        const AllocationCounts counts = allocation_scope.Counts();
+        DoNotOptimize(received);
+        if (AllocationTracker::Enabled()) {
+            std::cout << "    allocations/packet="
+                << static_cast<double>(counts.allocations) / kPackets << std::endl;
+            RequireNoAllocations(name, counts);
+        }
+    }
+}
+
+namespace {
+    // Sends bursts of kBurstPackets packets to |destination| and runs the
+    // handlers until each burst is |received|.
+    void RunBursts(const std::string& name, boost::asio::io_service& io_service,
+                   const boost::asio::ip::udp::endpoint& destination, const uint64_t& received) {
+        boost::asio::ip::udp::socket sender(io_service, boost::asio::ip::udp::v4());
+        const char payload[kPacketSize] = {};
+        RunBenchmark(name, kBursts, [&](uint64_t) {
+            for (size_t i = 0; i < kBurstPackets; ++i) {
+                sender.send_to(boost::asio::buffer(payload, kPacketSize), destination);
+            }
+            const uint64_t target = received + kBurstPackets;
+            while (received < target) {
+                io_service.run_one();
+            }
+        });
+    }
+
+    boost::asio::ip::udp::socket OpenLoopbackSocket(boost::asio::io_service& io_service,
+                                                    boost::asio::ip::udp::endpoint& endpoint) {
+        boost::asio::ip::udp::socket socket(io_service, boost::asio::ip::udp::endpoint(
+            boost::asio::ip::address_v4::loopback(), 0));
+        endpoint = socket.local_endpoint();
+        return socket;
+    }
+
+    // One callback per packet against one per wakeup.
+    void RunBatchBenchmark() {
+        const std::string suffix = ", " + std::to_string(kBurstPackets) + " packet bursts";
+        boost::asio::io_service io_service;
+        boost::asio::ip::udp::endpoint destination;
+        uint64_t received = 0;
+        uint64_t callbacks = 0;
+
+        auto engine = MakeReceiveEngine([&](const std::string&, const uint8_t*, size_t) {
+            ++received;
+            ++callbacks;
+            return true;
+        });
+        engine.AddSocket("127.0.0.1", OpenLoopbackSocket(io_service, destination));
+        engine.Start();
+        RunBursts("ReceiveEngine" + suffix, io_service, destination, received);
+        std::cout << "    callbacks/burst=" << static_cast<double>(callbacks) / kBursts
+            << std::endl;
+        engine.Close();
+
+        received = 0;
+        callbacks = 0;
+        auto batch_engine = MakeBatchReceiveEngine([&](const PacketDescriptor*, size_t count) {
+            received += count;
+            ++callbacks;
+            return true;
+        });
+        batch_engine.AddSocket("127.0.0.1", OpenLoopbackSocket(io_service, destination));
+        batch_engine.Start();
+        RunBursts("BatchReceiveEngine" + suffix, io_service, destination, received);
+        std::cout << "    callbacks/burst=" << static_cast<double>(callbacks) / kBursts
+            << std::endl;
+        batch_engine.Close();
+    }
+}
+
+void BenchmarkReceive() {
+    // An address longer than the small string buffer makes the copy in the
+    // bound handler allocate, as it does for IPv6 interfaces.
+    const std::string ips[] = { "127.0.0.1", "fe80::1c2b:3aff:fe4d:5e6f%eth0" };
+    for (size_t i = 0; i < sizeof(ips) / sizeof(ips[0]); ++i) {
+        RunReceiveBenchmark("Receive cycle, asio allocation, " + ips[i], ips[i], false);
+        RunReceiveBenchmark("Receive cycle, handler memory, " + ips[i], ips[i], true);
+        RunReceiveEngineBenchmark("Receive cycle, ReceiveEngine, " + ips[i], ips[i]);
+    }
+    RunBatchBenchmark();
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// Measures the IpDetector style receive cycle over loopback UDP: the
+// completion handler bound with boost::bind, the std::function callback and
+// posting the next receive. Reports the cost and the heap allocations per
+// packet, the benchmark build counts them with TRACK_ALLOCATIONS.
+void BenchmarkReceive();
@@ -0,0 +1,154 @@
+#include "allocation_tracker.h"
+
+#include <assert.h>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "logger.h"
+
+namespace {
+    // Plain values, so the first allocation of a thread doesn't allocate
+    // or register a destructor itself.
+    thread_local uint64_t thread_allocations = 0;
+    thread_local uint64_t thread_bytes = 0;
+    thread_local uint64_t thread_frees = 0;
+
+    std::atomic<uint64_t> total_allocations(0);
+    std::atomic<uint64_t> total_bytes(0);
+    std::atomic<uint64_t> total_frees(0);
+
+#if defined(TRACK_ALLOCATIONS)
+    void* TrackedAllocate(std::size_t size) {
+        ++thread_allocations;
+        thread_bytes += size;
+        total_allocations.fetch_add(1, std::memory_order_relaxed);
+        total_bytes.fetch_add(size, std::memory_order_relaxed);
+        return malloc(size == 0 ? 1 : size);
+    }
+
+    void TrackedFree(void* pointer) {
+        if (!pointer) {
+            return;
+        }
+        ++thread_frees;
+        total_frees.fetch_add(1, std::memory_order_relaxed);
+        free(pointer);
+    }
+#endif
+}
+
+#if defined(TRACK_ALLOCATIONS)
+void* operator new(std::size_t size) {
+    void* pointer = TrackedAllocate(size);
+    if (!pointer) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return TrackedAllocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return TrackedAllocate(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    TrackedFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    TrackedFree(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    TrackedFree(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    TrackedFree(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    TrackedFree(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+    TrackedFree(pointer);
+}
+#endif
+
+bool AllocationTracker::Enabled() {
+#if defined(TRACK_ALLOCATIONS)
+    return true;
+#else
+    return false;
+#endif
+}
+
+AllocationCounts AllocationTracker::ThreadCounts() {
+    AllocationCounts counts;
+    counts.allocations = thread_allocations;
+    counts.bytes = thread_bytes;
+    counts.frees = thread_frees;
+    return counts;
+}
+
+AllocationCounts AllocationTracker::TotalCounts() {
+    AllocationCounts counts;
+    counts.allocations = total_allocations.load(std::memory_order_relaxed);
+    counts.bytes = total_bytes.load(std::memory_order_relaxed);
+    counts.frees = total_frees.load(std::memory_order_relaxed);
+    return counts;
+}
+
+AllocationCounts AllocationScope::Counts() const {
+    const AllocationCounts now = AllocationTracker::ThreadCounts();
+    AllocationCounts counts;
+    counts.allocations = now.allocations - start_.allocations;
+    counts.bytes = now.bytes - start_.bytes;
+    counts.frees = now.frees - start_.frees;
+    return counts;
+}
+
+NoAllocationScope::~NoAllocationScope() {
+    const AllocationCounts counts = scope_.Counts();
+    if (counts.allocations == 0) {
+        return;
+    }
+    LOG_ERROR << counts.allocations << " allocations of " << counts.bytes
+        << " bytes in the no-allocation region " << region_ << ENDLINE;
+    assert(counts.allocations == 0);
+}
+
+void TestAllocationTracker() {
+    if (!AllocationTracker::Enabled()) {
+        LOG_INFO << "Build with TRACK_ALLOCATIONS to count allocations" << ENDLINE;
+        return;
+    }
+    AllocationScope scope;
+    std::vector<std::string> strings;
+    for (int i = 0; i < 100; ++i) {
+        strings.push_back(std::string(64, 'x'));
+    }
+    const AllocationCounts counts = scope.Counts();
+    LOG_INFO << "100 strings took " << counts.allocations << " allocations of "
+        << counts.bytes << " bytes" << ENDLINE;
+
+    uint64_t sum = 0;
+    {
+        ASSERT_NO_ALLOCATIONS("TestAllocationTracker");
+        for (auto iter = strings.begin(); iter != strings.end(); ++iter) {
+            sum += iter->size();
+        }
+    }
+    LOG_INFO << "Sum of the sizes " << sum << ENDLINE;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+// Counts the heap allocations of every thread. It only counts when the
+// program is built with TRACK_ALLOCATIONS, which replaces the global
+// operator new and delete in allocation_tracker.cpp. The debug and the
+// benchmark builds define it. Otherwise every count stays zero.
+struct AllocationCounts {
+    AllocationCounts() : allocations(0), bytes(0), frees(0) {}
+
+    uint64_t allocations;
+    uint64_t bytes;
+    uint64_t frees;
+};
+
+class AllocationTracker {
+public:
+    static bool Enabled();
+    // Since the calling thread started.
+    static AllocationCounts ThreadCounts();
+    // Of all the threads.
+    static AllocationCounts TotalCounts();
+};
+
+// Counts what the calling thread allocates during its lifetime, scopes may
+// be nested.
+class AllocationScope {
+public:
+    AllocationScope() : start_(AllocationTracker::ThreadCounts()) {}
+
+    AllocationCounts Counts() const;
+
+private:
+    AllocationCounts start_;
+};
+
+// Reports any allocation of the calling thread during its lifetime as an
+// error, and fails an assert in debug builds. |region| has to outlive it.
+class NoAllocationScope {
+public:
+    explicit NoAllocationScope(const char* region) : region_(region) {}
+    ~NoAllocationScope();
+
+private:
+    const char* region_;
+    AllocationScope scope_;
+};
+
+#define ALLOCATION_CONCAT_(a, b) a##b
+#define ALLOCATION_CONCAT(a, b) ALLOCATION_CONCAT_(a, b)
+
+// The scope's name has the line in it, so a function can have several.
+#if defined(TRACK_ALLOCATIONS)
+#define ASSERT_NO_ALLOCATIONS(region) \
+    NoAllocationScope ALLOCATION_CONCAT(no_allocation_scope_, __LINE__)(region)
+#else
+#define ASSERT_NO_ALLOCATIONS(region)
+#endif
+
+void TestAllocationTracker();
@@ -0,0 +1,35 @@
+#include "asio_receive_backend.h"
+
+#include "multicast_socket.h"
+#include "packet_tracer.h"
+
+constexpr size_t AsioReceiveBackend::kBufferSize;
+
+AsioReceiveBackend::AsioReceiveBackend() : work_(io_service_) {
+}
+
+bool AsioReceiveBackend::OpenSocket(const std::string& multicast_ip, uint16_t port,
+                                    const std::string& local_ip, bool kernel_timestamps,
+                                    std::string* error) {
+    std::unique_ptr<Socket> socket(new Socket(io_service_));
+    if (!OpenMulticastReceiveSocket(socket->socket, multicast_ip, local_ip, port, filter_, error)) {
+        return false;
+    }
+    if (kernel_timestamps) {
+        PacketTracer::EnableKernelTimestamps(socket->socket);
+    }
+    socket->ip = local_ip;
+    sockets_.push_back(std::move(socket));
+    return true;
+}
+
+uint64_t AsioReceiveBackend::KernelRxNanoseconds(Socket& socket) {
+    return PacketTracer::KernelRxNanoseconds(socket.socket);
+}
+
+void AsioReceiveBackend::CloseAll() {
+    boost::system::error_code ec;
+    for (auto iter = sockets_.begin(); iter != sockets_.end(); ++iter) {
+        (*iter)->socket.close(ec);
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "handler_memory.h"
+#include "socket_filter.h"
+
+// The ReceiveBackend of BasicIpDetector: multicast sockets on an asio
+// io_service. A backend provides a Socket type with the |ip| of its
+// interface and the |sender| of the last packet, and the members below.
+class AsioReceiveBackend {
+public:
+    static constexpr size_t kBufferSize = 1500;
+
+    struct Socket {
+        explicit Socket(boost::asio::io_service& io_service) : socket(io_service) {}
+
+        std::string ip;
+        boost::asio::ip::udp::socket socket;
+        boost::asio::ip::udp::endpoint sender;
+        // The receive operation, so re-arming doesn't allocate.
+        HandlerMemory handler_memory;
+        uint8_t buffer[kBufferSize];
+    };
+
+    AsioReceiveBackend();
+
+    // Attached to the sockets opened afterwards.
+    void SetSocketFilter(const SocketFilterProgram& filter) { filter_ = filter; }
+    // Joins |multicast_ip|:|port| on the interface |local_ip|. Doesn't log,
+    // a failure is described in |error|.
+    bool OpenSocket(const std::string& multicast_ip, uint16_t port,
+                    const std::string& local_ip, bool kernel_timestamps, std::string* error);
+    size_t SocketCount() const { return sockets_.size(); }
+
+    // Calls |function| with every open socket.
+    template <typename Function>
+    void ForEachOpenSocket(Function function) {
+        for (auto iter = sockets_.begin(); iter != sockets_.end(); ++iter) {
+            if ((*iter)->socket.is_open()) {
+                function(**iter);
+            }
+        }
+    }
+
+    // |handler| is called as handler(error, bytes_transferred).
+    template <typename Handler>
+    void AsyncReceive(Socket& socket, Handler handler) {
+        socket.socket.async_receive_from(boost::asio::buffer(socket.buffer, kBufferSize),
+            socket.sender, MakeCustomAllocHandler(socket.handler_memory, std::move(handler)));
+    }
+
+    // Zero if the platform can't tell, see PacketTracer.
+    static uint64_t KernelRxNanoseconds(Socket& socket);
+
+    void CloseAll();
+
+    // Runs the handlers until Stop().
+    void Run() { io_service_.run(); }
+    void Stop() { io_service_.stop(); }
+    bool Stopped() const { return io_service_.stopped(); }
+
+private:
+    AsioReceiveBackend(const AsioReceiveBackend&) = delete;
+    AsioReceiveBackend& operator=(const AsioReceiveBackend&) = delete;
+
+    boost::asio::io_service io_service_;
+    boost::asio::io_service::work work_;
+    std::vector<std::unique_ptr<Socket>> sockets_;
+    SocketFilterProgram filter_;
+};
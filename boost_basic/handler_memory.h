@@ -0,0 +1,83 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+
+// A fixed slab for the operation of one outstanding asynchronous call, e.g.
+// the receive of one socket. Re-arming the call after its handler has run
+// reuses the slab instead of the heap. An operation larger than the slab,
+// or a second one while the slab is taken, falls back to operator new.
+// Not thread safe, the operations of one slab have to be started and
+// completed from one thread or a strand.
+class HandlerMemory {
+public:
+    static constexpr std::size_t kSize = 512;
+
+    HandlerMemory() : in_use_(false), fallback_count_(0) {}
+
+    void* Allocate(std::size_t size) {
+        if (!in_use_ && size <= sizeof(storage_)) {
+            in_use_ = true;
+            return &storage_;
+        }
+        ++fallback_count_;
+        return ::operator new(size);
+    }
+
+    void Deallocate(void* pointer) {
+        if (pointer == &storage_) {
+            in_use_ = false;
+            return;
+        }
+        ::operator delete(pointer);
+    }
+
+    // Operations which didn't fit the slab.
+    uint64_t FallbackCount() const { return fallback_count_; }
+
+private:
+    HandlerMemory(const HandlerMemory&) = delete;
+    HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+    typename std::aligned_storage<kSize>::type storage_;
+    bool in_use_;
+    uint64_t fallback_count_;
+};
+
+// Allocates the operation of |Handler| from a HandlerMemory, the other
+// hooks keep their defaults.
+template <typename Handler>
+class CustomAllocHandler {
+public:
+    CustomAllocHandler(HandlerMemory& memory, Handler handler)
+        : memory_(&memory), handler_(std::move(handler)) {
+    }
+
+    template <typename... Args>
+    void operator()(Args&&... args) {
+        handler_(std::forward<Args>(args)...);
+    }
+
+    friend void* asio_handler_allocate(std::size_t size, CustomAllocHandler* handler) {
+        return handler->memory_->Allocate(size);
+    }
+
+    friend void asio_handler_deallocate(void* pointer, std::size_t,
+                                        CustomAllocHandler* handler) {
+        handler->memory_->Deallocate(pointer);
+    }
+
+private:
+    HandlerMemory* memory_;
+    Handler handler_;
+};
+
+// |memory| has to outlive the operation.
+template <typename Handler>
+CustomAllocHandler<typename std::decay<Handler>::type> MakeCustomAllocHandler(
+    HandlerMemory& memory, Handler&& handler) {
+    return CustomAllocHandler<typename std::decay<Handler>::type>(
+        memory, std::forward<Handler>(handler));
+}
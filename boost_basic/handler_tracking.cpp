@@ -0,0 +1,168 @@
+#include "handler_tracking.h"
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+#include "logger.h"
+
+namespace {
+    const char kQueueMetric[] = "asio_handler_queue_ns";
+    const char kLatencyMetric[] = "asio_handler_latency_ns";
+    const char kRunMetric[] = "asio_handler_run_ns";
+    const char kHandlerLabel[] = "{handler=\"";
+
+    struct HandlerStats {
+        HandlerStats() : queue(nullptr), latency(nullptr), run(nullptr) {}
+
+        std::string type;
+        const MetricSnapshot* queue;
+        const MetricSnapshot* latency;
+        const MetricSnapshot* run;
+    };
+
+    // The handler type of asio_handler_run_ns{handler="receive"}, empty if
+    // |snapshot| isn't a |metric| histogram.
+    std::string HandlerType(const MetricSnapshot& snapshot, const std::string& metric) {
+        const std::string prefix = metric + kHandlerLabel;
+        if (snapshot.kind != kMetricHistogram ||
+            snapshot.name.compare(0, prefix.size(), prefix) != 0) {
+            return std::string();
+        }
+        const size_t end = snapshot.name.find('"', prefix.size());
+        return snapshot.name.substr(prefix.size(), end - prefix.size());
+    }
+
+    // "-" for a histogram the handler type doesn't have.
+    std::string Mean(const MetricSnapshot* snapshot) {
+        if (!snapshot) {
+            return "-";
+        }
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1)
+            << (snapshot->count > 0 ? static_cast<double>(snapshot->sum) / snapshot->count : 0);
+        return out.str();
+    }
+
+    // The bound of the bucket the 99th percentile falls in.
+    std::string Percentile99(const MetricSnapshot* snapshot) {
+        if (!snapshot || snapshot->count == 0) {
+            return "-";
+        }
+        const uint64_t rank = snapshot->count - snapshot->count / 100;
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < snapshot->bounds.size(); ++i) {
+            cumulative += snapshot->buckets[i];
+            if (cumulative >= rank) {
+                return "<=" + std::to_string(snapshot->bounds[i]);
+            }
+        }
+        return ">" + std::to_string(snapshot->bounds.back());
+    }
+}
+
+HandlerTrackingMetrics HandlerTrackingMetrics::Create(const std::string& handler_type,
+                                                      HandlerKind kind) {
+    static const std::vector<uint64_t> bounds = {
+        1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000,
+        1000000, 10000000, 100000000, 1000000000
+    };
+    MetricsRegistry& registry = MetricsRegistry::Instance();
+    const std::string label = kHandlerLabel + handler_type + "\"}";
+    HandlerTrackingMetrics metrics;
+    if (kind == kPostedHandler) {
+        metrics.wait_ns = registry.AddHistogram(kQueueMetric + label,
+            "Nanoseconds from posting the handler to running it", bounds);
+    }
+    else {
+        metrics.wait_ns = registry.AddHistogram(kLatencyMetric + label,
+            "Nanoseconds from starting the operation to running its handler", bounds);
+    }
+    metrics.run_ns = registry.AddHistogram(kRunMetric + label,
+        "Nanoseconds spent running the handler", bounds);
+    return metrics;
+}
+
+std::string FormatHandlerReport(const std::vector<MetricSnapshot>& snapshots) {
+    std::map<std::string, HandlerStats> by_type;
+    uint64_t total_run_ns = 0;
+    for (auto iter = snapshots.begin(); iter != snapshots.end(); ++iter) {
+        std::string type = HandlerType(*iter, kQueueMetric);
+        if (!type.empty()) {
+            by_type[type].queue = &*iter;
+            continue;
+        }
+        type = HandlerType(*iter, kLatencyMetric);
+        if (!type.empty()) {
+            by_type[type].latency = &*iter;
+            continue;
+        }
+        type = HandlerType(*iter, kRunMetric);
+        if (!type.empty()) {
+            by_type[type].run = &*iter;
+            total_run_ns += iter->sum;
+        }
+    }
+
+    std::vector<HandlerStats> handlers;
+    for (auto iter = by_type.begin(); iter != by_type.end(); ++iter) {
+        iter->second.type = iter->first;
+        handlers.push_back(iter->second);
+    }
+    std::sort(handlers.begin(), handlers.end(),
+        [](const HandlerStats& left, const HandlerStats& right) {
+            const uint64_t left_ns = left.run ? left.run->sum : 0;
+            const uint64_t right_ns = right.run ? right.run->sum : 0;
+            return left_ns > right_ns;
+        });
+
+    std::ostringstream out;
+    out << std::left << std::setw(24) << "handler" << std::right
+        << std::setw(10) << "calls" << std::setw(8) << "run %"
+        << std::setw(14) << "queue mean" << std::setw(14) << "queue p99"
+        << std::setw(17) << "op latency mean" << std::setw(16) << "op latency p99"
+        << std::setw(12) << "run mean" << std::setw(14) << "run p99" << "  (ns)\n";
+    out << std::fixed << std::setprecision(1);
+    for (auto iter = handlers.begin(); iter != handlers.end(); ++iter) {
+        const uint64_t calls = iter->run ? iter->run->count : 0;
+        const double share = total_run_ns > 0 && iter->run ?
+            100.0 * static_cast<double>(iter->run->sum) / total_run_ns : 0;
+        out << std::left << std::setw(24) << iter->type << std::right
+            << std::setw(10) << calls << std::setw(8) << share
+            << std::setw(14) << Mean(iter->queue) << std::setw(14) << Percentile99(iter->queue)
+            << std::setw(17) << Mean(iter->latency) << std::setw(16) << Percentile99(iter->latency)
+            << std::setw(12) << Mean(iter->run) << std::setw(14) << Percentile99(iter->run)
+            << "\n";
+    }
+    return out.str();
+}
+
+void TestHandlerTracking() {
+    const HandlerTrackingMetrics post_metrics =
+        HandlerTrackingMetrics::Create("test_post", kPostedHandler);
+    const HandlerTrackingMetrics timer_metrics =
+        HandlerTrackingMetrics::Create("test_timer", kOperationHandler);
+
+    boost::asio::io_service io_service;
+    boost::asio::deadline_timer timer(io_service);
+    int remaining_timers = 100;
+    std::function<void(const boost::system::error_code&)> on_timer =
+        [&](const boost::system::error_code& error) {
+            if (error || --remaining_timers == 0) {
+                return;
+            }
+            timer.expires_from_now(boost::posix_time::microseconds(100));
+            timer.async_wait(TrackHandler(on_timer, timer_metrics));
+        };
+    timer.expires_from_now(boost::posix_time::microseconds(100));
+    timer.async_wait(TrackHandler(on_timer, timer_metrics));
+    for (int i = 0; i < 10000; ++i) {
+        io_service.post(TrackHandler([]() {}, post_metrics));
+    }
+    io_service.run();
+
+    LOG_INFO << "Handler report:\n"
+        << FormatHandlerReport(MetricsRegistry::Instance().Snapshot()) << ENDLINE;
+}
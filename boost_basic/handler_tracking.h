@@ -0,0 +1,96 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "metrics.h"
+#include "tsc_clock.h"
+
+// A posted handler waits in the io_service queue only. The handler of an
+// operation, e.g. a receive or a timer, also waits for the operation.
+enum HandlerKind {
+    kPostedHandler,
+    kOperationHandler
+};
+
+// Histograms of one kind of completion handler. The wait from wrapping the
+// handler to the io_service entering it is asio_handler_queue_ns{handler="<type>"}
+// for a posted handler and asio_handler_latency_ns{handler="<type>"}, the
+// operation latency, for an operation's, whose wait is mostly the idle time
+// until a packet arrives. The run time is asio_handler_run_ns{handler="<type>"}.
+struct HandlerTrackingMetrics {
+    static HandlerTrackingMetrics Create(const std::string& handler_type, HandlerKind kind);
+
+    MetricHistogram wait_ns;
+    MetricHistogram run_ns;
+};
+
+// Wraps a completion handler to time it. Unlike
+// BOOST_ASIO_ENABLE_HANDLER_TRACKING it costs two clock reads and two
+// histogram updates per handler, so it can stay on in production. The
+// allocation, invocation and continuation hooks go to the wrapped handler,
+// a handler bound to a strand still runs in the strand.
+template <typename Handler>
+class TrackedHandler {
+public:
+    TrackedHandler(Handler handler, const HandlerTrackingMetrics& metrics)
+        : handler_(std::move(handler)),
+        metrics_(&metrics),
+        start_ticks_(logger::TscClock::ReadTicks()) {
+    }
+
+    template <typename... Args>
+    void operator()(Args&&... args) {
+        const logger::TscClock& clock = logger::TscClock::Instance();
+        const uint64_t entry_ticks = logger::TscClock::ReadTicks();
+        metrics_->wait_ns.Observe(
+            clock.ToNanoseconds(entry_ticks) - clock.ToNanoseconds(start_ticks_));
+        handler_(std::forward<Args>(args)...);
+        metrics_->run_ns.Observe(clock.NowNanoseconds() - clock.ToNanoseconds(entry_ticks));
+    }
+
+    friend void* asio_handler_allocate(std::size_t size, TrackedHandler* tracked) {
+        return boost_asio_handler_alloc_helpers::allocate(size, tracked->handler_);
+    }
+
+    friend void asio_handler_deallocate(void* pointer, std::size_t size,
+                                        TrackedHandler* tracked) {
+        boost_asio_handler_alloc_helpers::deallocate(pointer, size, tracked->handler_);
+    }
+
+    friend bool asio_handler_is_continuation(TrackedHandler* tracked) {
+        return boost_asio_handler_cont_helpers::is_continuation(tracked->handler_);
+    }
+
+    template <typename Function>
+    friend void asio_handler_invoke(Function& function, TrackedHandler* tracked) {
+        boost_asio_handler_invoke_helpers::invoke(function, tracked->handler_);
+    }
+
+    template <typename Function>
+    friend void asio_handler_invoke(const Function& function, TrackedHandler* tracked) {
+        boost_asio_handler_invoke_helpers::invoke(function, tracked->handler_);
+    }
+
+private:
+    Handler handler_;
+    const HandlerTrackingMetrics* metrics_;
+    uint64_t start_ticks_;
+};
+
+// |metrics| has to outlive the handler.
+template <typename Handler>
+TrackedHandler<typename std::decay<Handler>::type> TrackHandler(
+    Handler&& handler, const HandlerTrackingMetrics& metrics) {
+    return TrackedHandler<typename std::decay<Handler>::type>(
+        std::forward<Handler>(handler), metrics);
+}
+
+// A table of the tracked handler types in |snapshots| by their share of the
+// total run time, with the mean and the 99th percentile bucket of the
+// queueing delay or the operation latency, and of the run time.
+std::string FormatHandlerReport(const std::vector<MetricSnapshot>& snapshots);
+
+void TestHandlerTracking();
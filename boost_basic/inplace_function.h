@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename Signature, std::size_t Capacity = 32>
+class InplaceFunction;
+
+// A std::function which keeps the callable in a fixed buffer of |Capacity|
+// bytes and never allocates. A callable which doesn't fit fails to compile.
+// Calling an empty one throws std::bad_function_call.
+template <typename R, typename... Args, std::size_t Capacity>
+class InplaceFunction<R(Args...), Capacity> {
+public:
+    InplaceFunction() : invoke_(&InvokeEmpty), manage_(nullptr) {}
+    InplaceFunction(std::nullptr_t) : invoke_(&InvokeEmpty), manage_(nullptr) {}
+
+    template <typename Function, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<Function>::type, InplaceFunction>::value>::type>
+    InplaceFunction(Function&& function) {
+        using Stored = typename std::decay<Function>::type;
+        static_assert(sizeof(Stored) <= Capacity,
+            "The callable doesn't fit the InplaceFunction, raise its capacity");
+        static_assert(alignof(Stored) <= alignof(Storage),
+            "The callable is over aligned for the InplaceFunction");
+        new (&storage_) Stored(std::forward<Function>(function));
+        invoke_ = &Invoke<Stored>;
+        manage_ = &Manage<Stored>;
+    }
+
+    InplaceFunction(const InplaceFunction& other)
+        : invoke_(other.invoke_), manage_(other.manage_) {
+        if (manage_) {
+            manage_(kCopy, &storage_, &other.storage_);
+        }
+    }
+
+    InplaceFunction(InplaceFunction&& other)
+        : invoke_(other.invoke_), manage_(other.manage_) {
+        if (manage_) {
+            manage_(kMove, &storage_, &other.storage_);
+        }
+    }
+
+    ~InplaceFunction() {
+        Reset();
+    }
+
+    InplaceFunction& operator=(const InplaceFunction& other) {
+        if (this != &other) {
+            Reset();
+            invoke_ = other.invoke_;
+            manage_ = other.manage_;
+            if (manage_) {
+                manage_(kCopy, &storage_, &other.storage_);
+            }
+        }
+        return *this;
+    }
+
+    InplaceFunction& operator=(InplaceFunction&& other) {
+        if (this != &other) {
+            Reset();
+            invoke_ = other.invoke_;
+            manage_ = other.manage_;
+            if (manage_) {
+                manage_(kMove, &storage_, &other.storage_);
+            }
+        }
+        return *this;
+    }
+
+    explicit operator bool() const { return manage_ != nullptr; }
+
+    R operator()(Args... args) const {
+        return invoke_(&storage_, std::forward<Args>(args)...);
+    }
+
+private:
+    using Storage = typename std::aligned_storage<Capacity>::type;
+
+    enum Operation {
+        kCopy,
+        kMove,
+        kDestroy
+    };
+
+    using InvokeFunction = R(*)(void* storage, Args&&... args);
+    using ManageFunction = void(*)(Operation operation, void* target, void* source);
+
+    template <typename Stored>
+    static R Invoke(void* storage, Args&&... args) {
+        return (*static_cast<Stored*>(storage))(std::forward<Args>(args)...);
+    }
+
+    static R InvokeEmpty(void*, Args&&...) {
+        throw std::bad_function_call();
+    }
+
+    template <typename Stored>
+    static void Manage(Operation operation, void* target, void* source) {
+        switch (operation) {
+        case kCopy:
+            new (target) Stored(*static_cast<const Stored*>(source));
+            break;
+        case kMove:
+            new (target) Stored(std::move(*static_cast<Stored*>(source)));
+            break;
+        case kDestroy:
+            static_cast<Stored*>(target)->~Stored();
+            break;
+        }
+    }
+
+    void Reset() {
+        if (manage_) {
+            manage_(kDestroy, &storage_, nullptr);
+        }
+        invoke_ = &InvokeEmpty;
+        manage_ = nullptr;
+    }
+
+private:
+    // Mutable like the target of a std::function, which is called from a
+    // const operator().
+    mutable Storage storage_;
+    InvokeFunction invoke_;
+    ManageFunction manage_;
+};
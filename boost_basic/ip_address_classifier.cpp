@@ -0,0 +1,125 @@
+#include "ip_address_classifier.h"
+
+#include <string.h>
+
+#include "logger.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IP_CLASSIFIER_SSE2
+#include <emmintrin.h>
+#endif
+
+uint32_t PackIpV4(const boost::asio::ip::address_v4& ip) {
+    return static_cast<uint32_t>(ip.to_ulong());
+}
+
+IpV6Packed PackIpV6(const boost::asio::ip::address_v6& ip) {
+    boost::asio::ip::address_v6::bytes_type bytes = ip.to_bytes();
+    IpV6Packed packed = { 0, 0 };
+    for (size_t i = 0; i < 8; ++i) {
+        packed.high = (packed.high << 8) | bytes[i];
+        packed.low = (packed.low << 8) | bytes[i + 8];
+    }
+    return packed;
+}
+
+uint8_t ClassifyIpAddress(const boost::asio::ip::address& ip) {
+    if (ip.is_v4()) {
+        return ClassifyIpV4(PackIpV4(ip.to_v4()));
+    }
+    return ClassifyIpV6(PackIpV6(ip.to_v6()));
+}
+
+uint8_t ClassifyIpAddress(const std::string& ip) {
+    boost::system::error_code ec;
+    boost::asio::ip::address address = boost::asio::ip::address::from_string(ip, ec);
+    if (ec) {
+        return kIpClassNone;
+    }
+    return ClassifyIpAddress(address);
+}
+
+void ClassifyIpV4Batch(const uint32_t* ips, size_t count, uint8_t* classes) {
+    size_t i = 0;
+#ifdef IP_CLASSIFIER_SSE2
+    // Compares give all ones lanes, mask them with the flag and or them
+    // together, then narrow the four 32 bit lanes to four bytes.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask_8 = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+    const __m128i mask_12 = _mm_set1_epi32(static_cast<int>(0xFFF00000u));
+    const __m128i mask_16 = _mm_set1_epi32(static_cast<int>(0xFFFF0000u));
+    const __m128i mask_4 = _mm_set1_epi32(static_cast<int>(0xF0000000u));
+    const __m128i loopback = _mm_set1_epi32(0x7F000000);
+    const __m128i link_local = _mm_set1_epi32(static_cast<int>(0xA9FE0000u));
+    const __m128i private_10 = _mm_set1_epi32(0x0A000000);
+    const __m128i private_172 = _mm_set1_epi32(static_cast<int>(0xAC100000u));
+    const __m128i private_192 = _mm_set1_epi32(static_cast<int>(0xC0A80000u));
+    const __m128i multicast = _mm_set1_epi32(static_cast<int>(0xE0000000u));
+    const __m128i ssm = _mm_set1_epi32(static_cast<int>(0xE8000000u));
+
+    for (; i + 4 <= count; i += 4) {
+        const __m128i ip = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ips + i));
+        const __m128i top_8 = _mm_and_si128(ip, mask_8);
+        const __m128i top_16 = _mm_and_si128(ip, mask_16);
+
+        __m128i flags = _mm_and_si128(_mm_cmpeq_epi32(ip, zero),
+            _mm_set1_epi32(kIpClassUnspecified));
+        flags = _mm_or_si128(flags, _mm_and_si128(_mm_cmpeq_epi32(top_8, loopback),
+            _mm_set1_epi32(kIpClassLoopback)));
+        flags = _mm_or_si128(flags, _mm_and_si128(_mm_cmpeq_epi32(top_16, link_local),
+            _mm_set1_epi32(kIpClassLinkLocal)));
+        const __m128i is_private = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(top_8, private_10),
+                _mm_cmpeq_epi32(_mm_and_si128(ip, mask_12), private_172)),
+            _mm_cmpeq_epi32(top_16, private_192));
+        flags = _mm_or_si128(flags, _mm_and_si128(is_private,
+            _mm_set1_epi32(kIpClassPrivate)));
+        flags = _mm_or_si128(flags, _mm_and_si128(
+            _mm_cmpeq_epi32(_mm_and_si128(ip, mask_4), multicast),
+            _mm_set1_epi32(kIpClassMulticast)));
+        flags = _mm_or_si128(flags, _mm_and_si128(_mm_cmpeq_epi32(top_8, ssm),
+            _mm_set1_epi32(kIpClassSsm)));
+
+        const __m128i words = _mm_packs_epi32(flags, flags);
+        const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+        memcpy(classes + i, &packed, 4);
+    }
+#endif
+    for (; i < count; ++i) {
+        classes[i] = ClassifyIpV4(ips[i]);
+    }
+}
+
+void ClassifyIpV6Batch(const IpV6Packed* ips, size_t count, uint8_t* classes) {
+    // The per address classification has no branches, so this loop is left
+    // to the compiler's vectorizer.
+    for (size_t i = 0; i < count; ++i) {
+        classes[i] = ClassifyIpV6(ips[i]);
+    }
+}
+
+void TestIpAddressClassifier() {
+    const char* ips[] = { "127.0.0.1", "127.9.0.1", "127.255.255", "0.0.0.0",
+        "169.254.1.1", "172.16.0.1", "172.32.0.1", "192.168.1.1",
+        "239.0.0.100", "232.1.1.1", "::1", "fe80::1", "fd00::1", "ff02::1",
+        "ff35::1", "::ffff:10.0.0.1" };
+    for (size_t i = 0; i < sizeof(ips) / sizeof(ips[0]); ++i) {
+        LOG_INFO << ips[i] << " class: " << static_cast<int>(ClassifyIpAddress(ips[i]))
+            << ENDLINE;
+    }
+
+    const char* ip_v4s[] = { "127.0.0.1", "127.9.0.1", "0.0.0.0", "169.254.1.1",
+        "172.16.0.1", "172.32.0.1", "192.168.1.1", "239.0.0.100", "232.1.1.1" };
+    const size_t count = sizeof(ip_v4s) / sizeof(ip_v4s[0]);
+    uint32_t packed[count];
+    uint8_t classes[count];
+    for (size_t i = 0; i < count; ++i) {
+        packed[i] = PackIpV4(boost::asio::ip::address_v4::from_string(ip_v4s[i]));
+    }
+    ClassifyIpV4Batch(packed, count, classes);
+    for (size_t i = 0; i < count; ++i) {
+        if (classes[i] != ClassifyIpV4(packed[i])) {
+            LOG_ERROR << "Batch classification mismatch: " << ip_v4s[i] << ENDLINE;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <boost/asio/ip/address.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Classification flags of an ip address, several flags may be set at once,
+// e.g. an ssm address is also a multicast address.
+enum IpAddressClass : uint8_t {
+    kIpClassNone = 0,
+    kIpClassUnspecified = 1 << 0,
+    kIpClassLoopback = 1 << 1,
+    kIpClassLinkLocal = 1 << 2,
+    kIpClassPrivate = 1 << 3,
+    kIpClassMulticast = 1 << 4,
+    kIpClassSsm = 1 << 5,
+};
+
+// Ip v6 address packed into two integers in host byte order, |high| holds
+// the first 8 bytes of the address.
+struct IpV6Packed {
+    uint64_t high;
+    uint64_t low;
+};
+
+// Ip v4 address in host byte order, e.g. 127.0.0.1 is 0x7F000001.
+inline uint8_t ClassifyIpV4(uint32_t ip) {
+    return static_cast<uint8_t>(
+        ((ip == 0) ? kIpClassUnspecified : 0) |
+        (((ip & 0xFF000000u) == 0x7F000000u) ? kIpClassLoopback : 0) |
+        (((ip & 0xFFFF0000u) == 0xA9FE0000u) ? kIpClassLinkLocal : 0) |
+        (((ip & 0xFF000000u) == 0x0A000000u) ||
+         ((ip & 0xFFF00000u) == 0xAC100000u) ||
+         ((ip & 0xFFFF0000u) == 0xC0A80000u) ? kIpClassPrivate : 0) |
+        (((ip & 0xF0000000u) == 0xE0000000u) ? kIpClassMulticast : 0) |
+        (((ip & 0xFF000000u) == 0xE8000000u) ? kIpClassSsm : 0));
+}
+
+inline uint8_t ClassifyIpV6(const IpV6Packed& ip) {
+    // The v4 mapped form ::ffff:a.b.c.d is classified as the v4 address.
+    const bool v4_mapped = ip.high == 0 && (ip.low >> 32) == 0xFFFFu;
+    const uint8_t v4_class = ClassifyIpV4(static_cast<uint32_t>(ip.low));
+    return static_cast<uint8_t>(
+        (v4_mapped ? v4_class : 0) |
+        ((ip.high == 0 && ip.low == 0) ? kIpClassUnspecified : 0) |
+        ((ip.high == 0 && ip.low == 1) ? kIpClassLoopback : 0) |
+        (((ip.high >> 54) == 0x3FAu) ? kIpClassLinkLocal : 0) |
+        (((ip.high >> 57) == 0x7Eu) ? kIpClassPrivate : 0) |
+        (((ip.high >> 56) == 0xFFu) ? kIpClassMulticast : 0) |
+        ((((ip.high >> 32) & 0xFFF0FFFFu) == 0xFF300000u) ? kIpClassSsm : 0));
+}
+
+uint32_t PackIpV4(const boost::asio::ip::address_v4& ip);
+IpV6Packed PackIpV6(const boost::asio::ip::address_v6& ip);
+
+uint8_t ClassifyIpAddress(const boost::asio::ip::address& ip);
+// Returns kIpClassNone if |ip| is not a valid address.
+uint8_t ClassifyIpAddress(const std::string& ip);
+
+// Classify |count| addresses into |classes|. The v4 version uses sse2 when
+// it is available.
+void ClassifyIpV4Batch(const uint32_t* ips, size_t count, uint8_t* classes);
+void ClassifyIpV6Batch(const IpV6Packed* ips, size_t count, uint8_t* classes);
+
+void TestIpAddressClassifier();
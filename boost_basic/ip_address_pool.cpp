@@ -2,10 +2,19 @@
 
 #include <iostream>
 
+#if defined(IOS_MAC) || (defined(__linux__) && !defined(ANDROID))
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#endif
+
 #include "logger.h"
 
 using boost::asio::ip::tcp;
 
+namespace {
+    constexpr uint64_t kAddressLogsPerSecond = 64;
+}
+
 void TestIpAddress() {
     boost::asio::io_service io_service;
     IpAddressPool ip_address(io_service);
@@ -18,86 +27,162 @@ void TestIpAddress() {
 }
 
 IpAddressPool::IpAddressPool(boost::asio::io_service& io_service)
-    : io_service_(io_service){
-    ParseIpAddress();
+    : io_service_(io_service),
+    stop_refresh_(false) {
 }
 
+IpAddressPool::IpAddressPool()
+    : own_io_service_(new boost::asio::io_service()),
+    io_service_(*own_io_service_),
+    stop_refresh_(false) {
+}
 
 IpAddressPool::~IpAddressPool() {
+    StopBackgroundRefresh();
+}
+
+std::shared_ptr<IpAddressPool> IpAddressPool::GetSharedPool() {
+    // Only the pool object is created here, the enumeration is deferred to
+    // the first query.
+    static std::shared_ptr<IpAddressPool> shared_pool(new IpAddressPool());
+    return shared_pool;
 }
 
 std::vector<std::string> IpAddressPool::GetIpV4AddressList() const {
-    return ip_v4_list_;
+    return GetAddressList()->ip_v4_list;
 }
 
 std::vector<std::string> IpAddressPool::GetIpV6AddressList() const {
-    return ip_v6_list_;
+    return GetAddressList()->ip_v6_list;
+}
+
+std::vector<IpV4Interface> IpAddressPool::GetIpV4InterfaceList() const {
+    return GetAddressList()->ip_v4_interfaces;
 }
 
 size_t IpAddressPool::GetIpV4AddressListsSize() const {
-    return ip_v4_list_.size();
+    return GetAddressList()->ip_v4_list.size();
 }
 
 size_t IpAddressPool::GetIpV6AddressListsSize() const {
-    return ip_v6_list_.size();
+    return GetAddressList()->ip_v6_list.size();
+}
+
+void IpAddressPool::Refresh() {
+    bool parsed = false;
+    std::call_once(parse_flag_, [this, &parsed]() {
+        UpdateAddressList();
+        parsed = true;
+    });
+    if (!parsed) {
+        UpdateAddressList();
+    }
+}
+
+void IpAddressPool::StartBackgroundRefresh(std::chrono::milliseconds interval) {
+    StopBackgroundRefresh();
+    {
+        std::lock_guard<std::mutex> lock(refresh_mutex_);
+        stop_refresh_ = false;
+    }
+    refresh_thread_ = std::thread(&IpAddressPool::RefreshLoop, this, interval);
+}
+
+void IpAddressPool::StopBackgroundRefresh() {
+    {
+        std::lock_guard<std::mutex> lock(refresh_mutex_);
+        stop_refresh_ = true;
+    }
+    refresh_cv_.notify_all();
+    if (refresh_thread_.joinable()) {
+        refresh_thread_.join();
+    }
+}
+
+std::shared_ptr<const IpAddressPool::AddressList> IpAddressPool::GetAddressList() const {
+    std::call_once(parse_flag_, &IpAddressPool::UpdateAddressList, this);
+    return std::atomic_load(&address_list_);
+}
+
+void IpAddressPool::UpdateAddressList() const {
+    // Serialize the enumerations, a refresh may race with the first query.
+    std::lock_guard<std::mutex> lock(parse_mutex_);
+    std::shared_ptr<AddressList> address_list = std::make_shared<AddressList>();
+    ParseIpAddress(*address_list);
+    std::atomic_store(&address_list_,
+        std::shared_ptr<const AddressList>(std::move(address_list)));
+}
+
+void IpAddressPool::RefreshLoop(std::chrono::milliseconds interval) {
+    std::unique_lock<std::mutex> lock(refresh_mutex_);
+    while (!refresh_cv_.wait_for(lock, interval, [this]() { return stop_refresh_; })) {
+        lock.unlock();
+        Refresh();
+        lock.lock();
+    }
 }
 
 void IpAddressPool::PrintIpV4Address() const {
-    if (ip_v4_list_.size() < 1) {
+    std::shared_ptr<const AddressList> address_list = GetAddressList();
+    const std::vector<std::string>& ip_v4_list = address_list->ip_v4_list;
+    if (ip_v4_list.size() < 1) {
         LOG_INFO << "There is no ip v4 address." << ENDLINE;
         return;
     }
-    else if (ip_v4_list_.size() == 1) {
+    else if (ip_v4_list.size() == 1) {
         LOG_INFO << "The ip v4 address is: " << ENDLINE;
     }
     else {
         LOG_INFO << "The ip v4 addresses are: " << ENDLINE;
     }
 
-    for (auto iter = ip_v4_list_.begin(); iter != ip_v4_list_.end(); ++iter) {
-        LOG_INFO << *iter << ENDLINE;
+    for (auto iter = ip_v4_list.begin(); iter != ip_v4_list.end(); ++iter) {
+        LOG_RATE_LIMITED(LOG_INFO, kAddressLogsPerSecond) << *iter << ENDLINE;
     }
 }
 
 void IpAddressPool::PrintIpV6Address() const {
-    if (ip_v6_list_.size() < 1) {
+    std::shared_ptr<const AddressList> address_list = GetAddressList();
+    const std::vector<std::string>& ip_v6_list = address_list->ip_v6_list;
+    if (ip_v6_list.size() < 1) {
         LOG_INFO << "There is no ip v6 address." << ENDLINE;
         return;
     }
-    else if (ip_v6_list_.size() == 1) {
+    else if (ip_v6_list.size() == 1) {
         LOG_INFO << "The ip v6 address is: " << ENDLINE;
     }
     else {
         LOG_INFO << "The ip v6 addresses are: " << ENDLINE;
     }
 
-    for (auto iter = ip_v6_list_.begin(); iter != ip_v6_list_.end(); ++iter) {
-        std::cout << *iter << std::endl;
+    for (auto iter = ip_v6_list.begin(); iter != ip_v6_list.end(); ++iter) {
+        LOG_RATE_LIMITED(LOG_INFO, kAddressLogsPerSecond) << *iter << ENDLINE;
     }
 }
 
 #ifdef _WIN32
-void IpAddressPool::ParseIpAddress() {
+void IpAddressPool::ParseIpAddress(AddressList& address_list) const {
     using resolver = boost::asio::ip::tcp::resolver;
     resolver ip_resolver(io_service_);
     resolver::query query(boost::asio::ip::host_name(), "");
     resolver::iterator iter = ip_resolver.resolve(query);
     resolver::iterator end; // End marker.
-    std::vector<std::string> ip_address;
     while (iter != end) {
         tcp::endpoint ep = *iter++;
         if (ep.address().is_v4()) {
-            ip_v4_list_.push_back(ep.address().to_string());
+            // The resolver doesn't report the netmask.
+            address_list.ip_v4_list.push_back(ep.address().to_string());
+            address_list.ip_v4_interfaces.push_back({ ep.address().to_string(), 32 });
         }
         else {
-            ip_v6_list_.push_back(ep.address().to_string());
+            address_list.ip_v6_list.push_back(ep.address().to_string());
         }
     }
 }
 #endif
 
-#ifdef IOS_MAC
-bool IpAddressDetector::ParseIpAddress() {
+#if defined(IOS_MAC) || (defined(__linux__) && !defined(ANDROID))
+void IpAddressPool::ParseIpAddress(AddressList& address_list) const {
     struct ifaddrs * ifAddrStruct = NULL;
     struct ifaddrs * ifa = NULL;
     void * tmpAddrPtr = NULL;
@@ -111,22 +196,27 @@ bool IpAddressDetector::ParseIpAddress() {
             tmpAddrPtr = &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
             char addressBuffer[INET_ADDRSTRLEN];
             inet_ntop(AF_INET, tmpAddrPtr, addressBuffer, INET_ADDRSTRLEN);
-            ip_v4_list_.push_back(addressBuffer);
+            address_list.ip_v4_list.push_back(addressBuffer);
+            uint8_t prefix_length = 32;
+            if (ifa->ifa_netmask) {
+                uint32_t netmask = ntohl(
+                    ((struct sockaddr_in *)ifa->ifa_netmask)->sin_addr.s_addr);
+                for (prefix_length = 0; netmask & 0x80000000u; netmask <<= 1) {
+                    ++prefix_length;
+                }
+            }
+            address_list.ip_v4_interfaces.push_back({ addressBuffer, prefix_length });
         }
         else if (ifa->ifa_addr->sa_family == AF_INET6) { // check it is IP6
        //TODO
         }
     }
     if (ifAddrStruct != NULL) freeifaddrs(ifAddrStruct);
-    PrintIpV4Address();
-    if (ip_v4_list_.empty())
-        return false;
-    return true;
 }
 #endif
 
 #ifdef ANDROID
-bool IpAddressDetector::ParseIpAddress() {
+void IpAddressPool::ParseIpAddress(AddressList& address_list) const {
     // File descriptor for socket
     int socketfd;
     socketfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -136,7 +226,8 @@ bool IpAddressDetector::ParseIpAddress() {
         conf.ifc_len = sizeof(data);
         conf.ifc_buf = (caddr_t)data;
         if (ioctl(socketfd, SIOCGIFCONF, &conf) < 0) {
-            return false;
+            close(socketfd);
+            return;
         }
 
         struct ifreq *ifr;
@@ -147,7 +238,8 @@ bool IpAddressDetector::ParseIpAddress() {
             case AF_INET:
                 if (inet_ntop(AF_INET, &((struct sockaddr_in*)&ifr->ifr_addr)->sin_addr,
                     address_buffer, INET_ADDRSTRLEN)) {
-                    ip_v4_list_.push_back(address_buffer);
+                    address_list.ip_v4_list.push_back(address_buffer);
+                    address_list.ip_v4_interfaces.push_back({ address_buffer, 32 });
                 }
                 break;
             case AF_INET6:
@@ -158,14 +250,6 @@ bool IpAddressDetector::ParseIpAddress() {
         }
         close(socketfd);
     }
-    else {
-        return false;
-    }
-
-    if (ip_v4_list_.empty())
-        return false;
-    PrintIpV4Address();
-    return true;
 }
 #endif
 
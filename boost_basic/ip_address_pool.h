@@ -1,19 +1,37 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
 #include <string>
+#include <thread>
 #include <vector>
 
 void TestIpAddress();
 
+struct IpV4Interface {
+    std::string ip;
+    // 32 if the platform doesn't report the netmask.
+    uint8_t prefix_length;
+};
+
+// Local ip addresses of this host. The interfaces are enumerated lazily on
+// the first query, so constructing a pool never blocks.
 class IpAddressPool
 {
 public:
     IpAddressPool(boost::asio::io_service& io_service);
     ~IpAddressPool();
 
+    // The process-wide pool which is shared by all the detectors.
+    static std::shared_ptr<IpAddressPool> GetSharedPool();
+
     std::vector<std::string> GetIpV4AddressList() const;
     std::vector<std::string> GetIpV6AddressList() const;
+    std::vector<IpV4Interface> GetIpV4InterfaceList() const;
 
     size_t GetIpV4AddressListsSize() const;
     size_t GetIpV6AddressListsSize() const;
@@ -21,12 +39,36 @@ public:
     void PrintIpV4Address() const;
     void PrintIpV6Address() const;
 
+    // Enumerate the interfaces again, readers keep the old lists until the
+    // new ones are published.
+    void Refresh();
+    void StartBackgroundRefresh(std::chrono::milliseconds interval);
+    void StopBackgroundRefresh();
+
 private:
-    void ParseIpAddress();
+    struct AddressList {
+        std::vector<std::string> ip_v4_list;
+        std::vector<std::string> ip_v6_list;
+        std::vector<IpV4Interface> ip_v4_interfaces;
+    };
+
+    IpAddressPool();
+    std::shared_ptr<const AddressList> GetAddressList() const;
+    void UpdateAddressList() const;
+    void ParseIpAddress(AddressList& address_list) const;
+    void RefreshLoop(std::chrono::milliseconds interval);
 
 private:
+    std::unique_ptr<boost::asio::io_service> own_io_service_;
     boost::asio::io_service& io_service_;
-    std::vector<std::string> ip_v4_list_;
-    std::vector<std::string> ip_v6_list_;
-};
 
+    // Accessed with std::atomic_load/std::atomic_store only.
+    mutable std::shared_ptr<const AddressList> address_list_;
+    mutable std::once_flag parse_flag_;
+    mutable std::mutex parse_mutex_;
+
+    std::mutex refresh_mutex_;
+    std::condition_variable refresh_cv_;
+    bool stop_refresh_;
+    std::thread refresh_thread_;
+};
@@ -1,53 +1,335 @@
 #pragma once
 
-#include <boost/array.hpp>
-#include <boost/asio.hpp>
-#include <functional>
+#include <boost/bind.hpp>
 #include <memory>
 #include <mutex>
 #include <stdint.h>
 #include <string>
-#include <thread>
 #include <vector>
 
+#include "asio_receive_backend.h"
+#include "binary_logger.h"
+#include "inplace_function.h"
+#include "ip_address_classifier.h"
+#include "ip_address_pool.h"
+#include "ip_detector_policies.h"
+#include "ip_prefix_table.h"
+#include "logger.h"
+#include "socket_filter.h"
 
-class IpAddressPool;
-
-using IpDetectCallback = std::function<void(const std::string&)>;
+// Never allocates, a callable with larger captures fails to compile.
+using IpDetectCallback = InplaceFunction<void(const std::string&), 64>;
 
 // This class is used to detect valid local ip which can receive multicast data.
-class IpDetector {
+// The policies pick how it receives (ReceiveBackend), on which thread and
+// with which lock (ThreadingPolicy), whether it logs (LogPolicy) and what it
+// measures (MetricsPolicy), see ip_detector_policies.h. The null policies
+// compile their feature away, e.g. LeanIpDetector has no lock, no logging
+// and no metrics.
+template <typename ReceiveBackend, typename ThreadingPolicy, typename LogPolicy,
+          typename MetricsPolicy>
+class BasicIpDetector : public MetricsPolicy {
 public:
-    IpDetector(const std::string& multicast_ip, uint16_t multicast_port);
-    ~IpDetector();
+    BasicIpDetector(const std::string& multicast_ip, uint16_t multicast_port);
+    ~BasicIpDetector();
     bool StartDetect(IpDetectCallback callback);
-    static bool IsLoopbackIp(const std::string& ip);
+    // Has the kernel drop the packets which don't match |rules|, the group
+    // and port of the detector are used where |rules| leave them unset. Has
+    // to be called before StartDetect(), returns false if the rules don't
+    // compile. The sockets fail to open where the kernel refuses the filter.
+    bool SetSocketFilter(const SocketFilterRules& rules);
+    static bool IsLoopbackIp(const std::string& ip) {
+        return (ClassifyIpAddress(ip) & kIpClassLoopback) != 0;
+    }
 
 private:
+    using Socket = typename ReceiveBackend::Socket;
+    using Mutex = typename ThreadingPolicy::Mutex;
+
     bool InitSockets();
     void DoStartReceive();
     void DoAsyncReceive();
     void ReceiveHandler(const boost::system::error_code& error,
         std::size_t bytes_transferred,
-        const std::string& ip);
+        Socket& socket);
     void CloseAllSockets();
 
 private:
-    boost::asio::io_service io_service_;
-    boost::asio::io_service::work work_;
-    std::unique_ptr<IpAddressPool> ip_address_pool_;
+    // A network flap fails every pending receive at once.
+    static constexpr uint64_t kReceiveErrorLogsPerSecond = 10;
+
+    ReceiveBackend backend_;
+    ThreadingPolicy threading_;
+    std::shared_ptr<IpAddressPool> ip_address_pool_;
     IpDetectCallback callback_;
     std::string multicast_ip_;
     uint16_t multicast_port_;
-    std::map<std::string, boost::asio::ip::udp::socket> sockets_;
-    std::map<std::string, std::unique_ptr<uint8_t>> recv_buffers_;
-    std::map<std::string, boost::asio::ip::udp::endpoint> sender_endpoints_;
+    // The sender's subnet is counted by the metrics and named in the log, a
+    // detector with neither doesn't build the table.
+    static constexpr bool kClassifySenders =
+        LogPolicy::kEnabled || MetricsPolicy::kSubnetAccounting;
 
-    std::thread detect_thread_;
+    // Maps a sender address to the index of the local interface in
+    // interface_ips_ whose subnet contains it.
+    IpV4PrefixTable subnet_table_;
+    std::vector<std::string> interface_ips_;
 
     // The definition of this variable may cause crash, in boardcast project.
-    std::mutex socket_mutex_;
+    Mutex socket_mutex_;
 };
 
+using IpDetector = BasicIpDetector<AsioReceiveBackend, DetectThreadPolicy, LoggerLogPolicy,
+                                   RegistryMetricsPolicy>;
+using LeanIpDetector = BasicIpDetector<AsioReceiveBackend, CallerThreadPolicy, NullLogPolicy,
+                                       NullMetricsPolicy>;
+
+// Both are instantiated once, in ip_detector.cpp.
+extern template class BasicIpDetector<AsioReceiveBackend, DetectThreadPolicy, LoggerLogPolicy,
+                                      RegistryMetricsPolicy>;
+extern template class BasicIpDetector<AsioReceiveBackend, CallerThreadPolicy, NullLogPolicy,
+                                      NullMetricsPolicy>;
+
+template <typename ReceiveBackend, typename ThreadingPolicy, typename LogPolicy,
+          typename MetricsPolicy>
+constexpr uint64_t BasicIpDetector<ReceiveBackend, ThreadingPolicy, LogPolicy,
+                                   MetricsPolicy>::kReceiveErrorLogsPerSecond;
+
+template <typename ReceiveBackend, typename ThreadingPolicy, typename LogPolicy,
+          typename MetricsPolicy>
+constexpr bool BasicIpDetector<ReceiveBackend, ThreadingPolicy, LogPolicy,
+                               MetricsPolicy>::kClassifySenders;
+
+template <typename ReceiveBackend, typename ThreadingPolicy, typename LogPolicy,
+          typename MetricsPolicy>
+BasicIpDetector<ReceiveBackend, ThreadingPolicy, LogPolicy, MetricsPolicy>::BasicIpDetector(
+    const std::string& multicast_ip, uint16_t multicast_port)
+    : ip_address_pool_(IpAddressPool::GetSharedPool()),
+    multicast_ip_(multicast_ip),
+    multicast_port_(multicast_port) {
+    // The rate limited receive error log reads the clock, the metrics policy
+    // warms it up for the handler timing. A lean detector never reads it.
+    if (LogPolicy::kEnabled) {
+        logger::TscClock::WarmUp();
+    }
+}
+
+template <typename ReceiveBackend, typename ThreadingPolicy, typename LogPolicy,
+          typename MetricsPolicy>
+BasicIpDetector<ReceiveBackend, ThreadingPolicy, LogPolicy, MetricsPolicy>::~BasicIpDetector() {
+    backend_.Stop();
+    threading_.Join();
+}
+
+template <typename ReceiveBackend, typename ThreadingPolicy, typename LogPolicy,
+          typename MetricsPolicy>
+bool BasicIpDetector<ReceiveBackend, ThreadingPolicy, LogPolicy, MetricsPolicy>::StartDetect(
+    IpDetectCallback callback) {
+    callback_ = std::move(callback);
+
+    if (!InitSockets()) {
+        return false;
+    }
+
+    threading_.Launch([this]() { DoStartReceive(); });
+    return true;
+}
+
+template <typename ReceiveBackend, typename ThreadingPolicy, typename LogPolicy,
+          typename MetricsPolicy>
+bool BasicIpDetector<ReceiveBackend, ThreadingPolicy, LogPolicy, MetricsPolicy>::SetSocketFilter(
+    const SocketFilterRules& rules) {
+    SocketFilterRules detector_rules = rules;
+    if (detector_rules.group == 0) {
+        boost::system::error_code ec;
+        detector_rules.group = static_cast<uint32_t>(
+            boost::asio::ip::address_v4::from_string(multicast_ip_, ec).to_ulong());
+    }
+    if (detector_rules.port == 0) {
+        detector_rules.port = multicast_port_;
+    }
+
+    SocketFilterProgram program;
+    if (!CompileSocketFilter(detector_rules, &program)) {
+        if (LogPolicy::kEnabled) {
+            LOG_ERROR << "Socket filter rules don't compile" << ENDLINE;
+        }
+        return false;
+    }
+    backend_.SetSocketFilter(program);
+    return true;
+}
+
+template <typename ReceiveBackend, typename ThreadingPolicy, typename LogPolicy,
+          typename MetricsPolicy>
+bool BasicIpDetector<ReceiveBackend, ThreadingPolicy, LogPolicy, MetricsPolicy>::InitSockets() {
+    auto ip_v4_list = ip_address_pool_->GetIpV4InterfaceList();
+    boost::system::error_code ec;
+    std::string error;
+    for (size_t i = 0; i < ip_v4_list.size(); ++i) {
+        const boost::asio::ip::address local_address =
+            boost::asio::ip::address::from_string(ip_v4_list[i].ip, ec);
+        if (ec) {
+            continue;
+        }
+        // These addresses can't be the local interface of a multicast group.
+        // A public address has no class bits and is fine.
+        if (ClassifyIpAddress(local_address) &
+            (kIpClassUnspecified | kIpClassLoopback | kIpClassMulticast)) {
+            continue;
+        }
+
+        if (!backend_.OpenSocket(multicast_ip_, multicast_port_, ip_v4_list[i].ip,
+                                 this->TracingEnabled(), &error)) {
+            if (LogPolicy::kEnabled) {
+                LOG_ERROR << error << ENDLINE;
+            }
+            this->SocketError();
+            return false;
+        }
+        if (LogPolicy::kEnabled) {
+            FLIGHT_TRACE("Socket on {} joined {}:{}", ip_v4_list[i].ip, multicast_ip_,
+                multicast_port_);
+        }
+        this->InterfaceAdded(ip_v4_list[i].ip);
+
+        if (kClassifySenders) {
+            const uint32_t prefix = PackIpV4(local_address.to_v4());
+            subnet_table_.AddRoute(prefix, ip_v4_list[i].prefix_length,
+                static_cast<uint16_t>(interface_ips_.size()));
+            interface_ips_.push_back(ip_v4_list[i].ip);
+            this->SubnetAdded(prefix, ip_v4_list[i].prefix_length);
+        }
+    }
+    if (kClassifySenders) {
+        subnet_table_.Build();
+    }
+    // Nothing would ever complete, and a CallerThreadPolicy would block.
+    if (backend_.SocketCount() == 0) {
+        if (LogPolicy::kEnabled) {
+            LOG_WARN << "No interface to join " << multicast_ip_ << " on" << ENDLINE;
+        }
+        return false;
+    }
+    this->SocketsOpened(backend_.SocketCount(),
+        multicast_ip_ + ":" + std::to_string(multicast_port_));
+    return true;
+}
+
+template <typename ReceiveBackend, typename ThreadingPolicy, typename LogPolicy,
+          typename MetricsPolicy>
+void BasicIpDetector<ReceiveBackend, ThreadingPolicy, LogPolicy, MetricsPolicy>::DoStartReceive() {
+    this->OpenPerfCounters();
+    {
+        typename MetricsPolicy::ProfileScope profile_scope(*this);
+        DoAsyncReceive();
+    }
+    backend_.Run();
+}
+
+template <typename ReceiveBackend, typename ThreadingPolicy, typename LogPolicy,
+          typename MetricsPolicy>
+void BasicIpDetector<ReceiveBackend, ThreadingPolicy, LogPolicy, MetricsPolicy>::DoAsyncReceive() {
+    std::lock_guard<Mutex> lock(socket_mutex_);
+    backend_.ForEachOpenSocket([this](Socket& socket) {
+        if (LogPolicy::kEnabled) {
+            FLIGHT_TRACE("Receive posted on {}", socket.ip);
+        }
+        this->ReceivePosted();
+        // The socket outlives the receive, so the handler holds a reference
+        // instead of a copy of the address.
+        backend_.AsyncReceive(socket, this->WrapReceiveHandler(
+            boost::bind(&BasicIpDetector::ReceiveHandler, this,
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred,
+                boost::ref(socket))));
+    });
+}
+
+template <typename ReceiveBackend, typename ThreadingPolicy, typename LogPolicy,
+          typename MetricsPolicy>
+void BasicIpDetector<ReceiveBackend, ThreadingPolicy, LogPolicy, MetricsPolicy>::ReceiveHandler(
+    const boost::system::error_code& error,
+    std::size_t bytes_transferred,
+    Socket& socket) {
+    const std::string& ip = socket.ip;
+    const uint64_t handler_entry_ns = this->TracingEnabled() ? PacketTracer::NowNanoseconds() : 0;
+    typename MetricsPolicy::ProfileScope profile_scope(*this);
+    if (LogPolicy::kEnabled) {
+        FLIGHT_TRACE("Receive on {} completed, error {}, {} bytes",
+            ip, error.value(), bytes_transferred);
+    }
+    if (error) {
+        this->ReceiveError();
+        if (LogPolicy::kEnabled) {
+            LOG_RATE_LIMITED(LOG_WARN, kReceiveErrorLogsPerSecond)
+                << "Receive data error: " << error << ENDLINE;
+        }
+        return;
+    }
+
+    if (backend_.Stopped()) {
+        if (bytes_transferred > 0) {
+            this->PacketDropped();
+        }
+        if (LogPolicy::kEnabled) {
+            LOG_INFO << "The io_service has been stopped.";
+        }
+        return;
+    }
+
+    if (bytes_transferred > 0) {
+        const bool traced = this->SampleTrace();
+        PacketTrace trace;
+        if (traced) {
+            trace.sequence = this->TraceCount();
+            trace.interface_ip = ip;
+            trace.stage_ns[kStageKernelRx] = ReceiveBackend::KernelRxNanoseconds(socket);
+            trace.stage_ns[kStageHandlerEntry] = handler_entry_ns;
+        }
+
+        this->PacketReceived(ip, bytes_transferred);
+
+        if (LogPolicy::kEnabled) {
+            LOG_INFO << "Ip detected is: " << ip << ENDLINE;
+        }
+        if (kClassifySenders) {
+            const boost::asio::ip::address sender = socket.sender.address();
+            const uint16_t subnet = sender.is_v4() ?
+                subnet_table_.Lookup(PackIpV4(sender.to_v4())) : IpV4PrefixTable::kNoMatch;
+            this->SenderClassified(subnet);
+            if (LogPolicy::kEnabled && subnet != IpV4PrefixTable::kNoMatch) {
+                LOG_INFO << "Sender " << sender << " is on the subnet of "
+                    << interface_ips_[subnet] << ENDLINE;
+            }
+        }
+
+        backend_.Stop();
+        // The socket, and with it |ip|, stays valid after closing.
+        CloseAllSockets();
+
+        const uint64_t callback_start = this->CallbackStart();
+        if (traced) {
+            trace.stage_ns[kStageCallbackStart] = PacketTracer::NowNanoseconds();
+        }
+        callback_(ip);
+        this->CallbackDone(callback_start);
+        if (traced) {
+            trace.stage_ns[kStageCallbackReturn] = PacketTracer::NowNanoseconds();
+            this->RecordTrace(trace);
+        }
+    }
+}
+
+template <typename ReceiveBackend, typename ThreadingPolicy, typename LogPolicy,
+          typename MetricsPolicy>
+void BasicIpDetector<ReceiveBackend, ThreadingPolicy, LogPolicy, MetricsPolicy>::CloseAllSockets() {
+    std::lock_guard<Mutex> lock(socket_mutex_);
+    if (LogPolicy::kEnabled) {
+        FLIGHT_TRACE("Closing {} sockets", backend_.SocketCount());
+    }
+    backend_.CloseAll();
+    this->SocketsClosed();
+}
+
 void TestIpDetector();
-void TestLoopbackIp();
\ No newline at end of file
+void TestLoopbackIp();
@@ -0,0 +1,133 @@
+#include "ip_detector_policies.h"
+
+#include <boost/asio/ip/address_v4.hpp>
+
+#include "logger.h"
+#include "tsc_clock.h"
+
+constexpr bool LoggerLogPolicy::kEnabled;
+constexpr bool NullLogPolicy::kEnabled;
+constexpr bool RegistryMetricsPolicy::kSubnetAccounting;
+constexpr bool NullMetricsPolicy::kSubnetAccounting;
+
+RegistryMetricsPolicy::ReceiveMetrics RegistryMetricsPolicy::CreateReceiveMetrics() {
+    MetricsRegistry& registry = MetricsRegistry::Instance();
+    ReceiveMetrics metrics;
+    metrics.sockets = registry.AddGauge("ip_detector_sockets",
+        "Multicast sockets open");
+    metrics.socket_errors = registry.AddCounter("ip_detector_socket_errors_total",
+        "Sockets failed to open, join the group or bind");
+    metrics.receives_posted = registry.AddCounter("ip_detector_receives_posted_total",
+        "Asynchronous receives started");
+    metrics.packets = registry.AddCounter("ip_detector_packets_total",
+        "Packets received");
+    metrics.bytes = registry.AddCounter("ip_detector_bytes_total",
+        "Bytes received");
+    metrics.receive_errors = registry.AddCounter("ip_detector_receive_errors_total",
+        "Receives completed with an error");
+    metrics.dropped_packets = registry.AddCounter("ip_detector_dropped_packets_total",
+        "Packets received after the detection finished");
+    metrics.packet_bytes = registry.AddHistogram("ip_detector_packet_bytes",
+        "Size of the received packets", { 64, 128, 256, 512, 1024, 1500 });
+    metrics.callback_ns = registry.AddHistogram("ip_detector_callback_ns",
+        "Time spent in the detection callback", { 1000, 10000, 100000, 1000000, 10000000 });
+    return metrics;
+}
+
+RegistryMetricsPolicy::RegistryMetricsPolicy()
+    : metrics_(CreateReceiveMetrics()),
+    receive_handler_metrics_(HandlerTrackingMetrics::Create("ip_detector_receive",
+        kOperationHandler)),
+    off_subnet_packets_(MetricsRegistry::Instance().AddCounter(
+        "ip_detector_off_subnet_packets_total", "Packets from senders on no local subnet")),
+    open_sockets_(0),
+    perf_counters_enabled_(false) {
+    // The receive handlers and the callback are timed on the TscClock.
+    logger::TscClock::WarmUp();
+}
+
+void RegistryMetricsPolicy::EnablePacketTracing(uint32_t sample_every) {
+    packet_tracer_.reset(new PacketTracer(sample_every));
+}
+
+bool RegistryMetricsPolicy::WritePacketTrace(const std::string& path) const {
+    return packet_tracer_ && packet_tracer_->WriteChromeTrace(path);
+}
+
+void RegistryMetricsPolicy::EnablePerfCounters() {
+    perf_counters_enabled_ = true;
+    perf_metrics_ = PerfMetrics::Create("ip_detector_receive");
+}
+
+void RegistryMetricsPolicy::OpenPerfCounters() {
+    if (!perf_counters_enabled_) {
+        return;
+    }
+    perf_counters_.reset(new PerfCounterGroup());
+    if (!perf_counters_->Available()) {
+        LOG_WARN << "Perf counters are unavailable, check perf_event_paranoid" << ENDLINE;
+    }
+}
+
+void RegistryMetricsPolicy::InterfaceAdded(const std::string& ip) {
+    const std::string label = "{interface=\"" + ip + "\"}";
+    InterfaceMetrics interface_metrics;
+    interface_metrics.packets = MetricsRegistry::Instance().AddCounter(
+        "ip_detector_interface_packets_total" + label, "Packets received per interface");
+    interface_metrics.bytes = MetricsRegistry::Instance().AddCounter(
+        "ip_detector_interface_bytes_total" + label, "Bytes received per interface");
+    interface_metrics_[ip] = interface_metrics;
+}
+
+void RegistryMetricsPolicy::SubnetAdded(uint32_t prefix, uint8_t prefix_length) {
+    // Interfaces on one subnet share its counter.
+    const uint32_t mask = prefix_length == 0 ? 0 : (0xFFFFFFFFu << (32 - prefix_length));
+    const std::string label = "{subnet=\"" + boost::asio::ip::address_v4(prefix & mask).to_string() +
+        "/" + std::to_string(prefix_length) + "\"}";
+    subnet_packets_.push_back(MetricsRegistry::Instance().AddCounter(
+        "ip_detector_subnet_packets_total" + label, "Packets from senders per local subnet"));
+}
+
+void RegistryMetricsPolicy::SenderClassified(uint16_t subnet) const {
+    if (subnet < subnet_packets_.size()) {
+        subnet_packets_[subnet].Add();
+    }
+    else {
+        off_subnet_packets_.Add();
+    }
+}
+
+// The gauges are shared by every detector of the process, or of the group,
+// so each one adds its own sockets and takes them away again.
+void RegistryMetricsPolicy::SocketsOpened(size_t count, const std::string& group) {
+    SocketsClosed();
+    open_sockets_ = static_cast<int64_t>(count);
+    metrics_.sockets.Add(open_sockets_);
+    group_sockets_ = MetricsRegistry::Instance().AddGauge(
+        "ip_detector_group_sockets{group=\"" + group + "\"}",
+        "Sockets joined to the multicast group");
+    group_sockets_.Add(open_sockets_);
+}
+
+void RegistryMetricsPolicy::SocketsClosed() {
+    metrics_.sockets.Add(-open_sockets_);
+    group_sockets_.Add(-open_sockets_);
+    open_sockets_ = 0;
+}
+
+void RegistryMetricsPolicy::PacketReceived(const std::string& ip, size_t bytes) {
+    metrics_.packets.Add();
+    metrics_.bytes.Add(bytes);
+    metrics_.packet_bytes.Observe(bytes);
+    const InterfaceMetrics& interface_metrics = interface_metrics_[ip];
+    interface_metrics.packets.Add();
+    interface_metrics.bytes.Add(bytes);
+}
+
+uint64_t RegistryMetricsPolicy::CallbackStart() const {
+    return logger::TscClock::Instance().NowNanoseconds();
+}
+
+void RegistryMetricsPolicy::CallbackDone(uint64_t start) const {
+    metrics_.callback_ns.Observe(logger::TscClock::Instance().NowNanoseconds() - start);
+}
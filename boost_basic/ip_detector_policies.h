@@ -0,0 +1,206 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "handler_tracking.h"
+#include "metrics.h"
+#include "packet_tracer.h"
+#include "perf_counters.h"
+
+// Policies of BasicIpDetector, see ip_detector.h.
+
+// A lock which does nothing, for a detector used from one thread only.
+struct NullMutex {
+    void lock() {}
+    void unlock() {}
+};
+
+// ThreadingPolicy: receives on a thread of the detector, the sockets are
+// guarded by a mutex because the detector is destroyed from another thread.
+class DetectThreadPolicy {
+public:
+    using Mutex = std::mutex;
+
+    template <typename Function>
+    void Launch(Function function) {
+        detect_thread_ = std::thread(std::move(function));
+    }
+
+    void Join() {
+        if (detect_thread_.joinable()) {
+            detect_thread_.join();
+        }
+    }
+
+private:
+    std::thread detect_thread_;
+};
+
+// ThreadingPolicy: receives on the thread calling StartDetect(), which
+// returns once an ip is detected. Takes no locks.
+class CallerThreadPolicy {
+public:
+    using Mutex = NullMutex;
+
+    template <typename Function>
+    void Launch(Function function) {
+        function();
+    }
+
+    void Join() {}
+};
+
+// LogPolicy: the logger.h macros and the flight recorder. The detector
+// tests kEnabled around every statement, so NullLogPolicy leaves no code
+// behind.
+struct LoggerLogPolicy {
+    static constexpr bool kEnabled = true;
+};
+
+struct NullLogPolicy {
+    static constexpr bool kEnabled = false;
+};
+
+// MetricsPolicy: the MetricsRegistry, handler tracking, and the optional
+// perf counters and packet tracing. The detector inherits its public
+// members.
+class RegistryMetricsPolicy {
+public:
+    // The detector maps every sender to the local subnet it is on.
+    static constexpr bool kSubnetAccounting = true;
+
+    // Counts one region of the detect thread while it lives.
+    class ProfileScope {
+    public:
+        explicit ProfileScope(const RegistryMetricsPolicy& policy)
+            : perf_scope_(policy.perf_counters_.get(), policy.perf_metrics_) {
+        }
+
+    private:
+        PerfScope perf_scope_;
+    };
+
+    RegistryMetricsPolicy();
+
+    // Traces the stages of one packet in every |sample_every|, has to be
+    // called before StartDetect().
+    void EnablePacketTracing(uint32_t sample_every);
+    bool WritePacketTrace(const std::string& path) const;
+    // Counts cycles, instructions, cache misses and context switches of the
+    // receive cycle into perf_*_total{region="ip_detector_receive"}, has to
+    // be called before StartDetect().
+    void EnablePerfCounters();
+
+protected:
+    bool TracingEnabled() const { return packet_tracer_ != nullptr; }
+    // Called once per packet, true if this packet is traced.
+    bool SampleTrace() { return packet_tracer_ && packet_tracer_->Sample(); }
+    uint64_t TraceCount() const { return packet_tracer_->PacketCount(); }
+    void RecordTrace(const PacketTrace& trace) { packet_tracer_->Record(trace); }
+
+    // Called on the detect thread before the first receive.
+    void OpenPerfCounters();
+
+    template <typename Handler>
+    TrackedHandler<Handler> WrapReceiveHandler(Handler handler) const {
+        return TrackHandler(std::move(handler), receive_handler_metrics_);
+    }
+
+    void InterfaceAdded(const std::string& ip);
+    void SocketsOpened(size_t count, const std::string& group);
+    void SocketsClosed();
+    void SocketError() { metrics_.socket_errors.Add(); }
+    void ReceivePosted() { metrics_.receives_posted.Add(); }
+    void ReceiveError() { metrics_.receive_errors.Add(); }
+    void PacketDropped() { metrics_.dropped_packets.Add(); }
+    void PacketReceived(const std::string& ip, size_t bytes);
+    // Subnet i of SenderClassified() is the i-th added, |prefix| is in host
+    // byte order.
+    void SubnetAdded(uint32_t prefix, uint8_t prefix_length);
+    // |subnet| is IpV4PrefixTable::kNoMatch for a sender on no local subnet.
+    void SenderClassified(uint16_t subnet) const;
+
+    uint64_t CallbackStart() const;
+    void CallbackDone(uint64_t start) const;
+
+private:
+    struct ReceiveMetrics {
+        MetricGauge sockets;
+        MetricCounter socket_errors;
+        MetricCounter receives_posted;
+        MetricCounter packets;
+        MetricCounter bytes;
+        MetricCounter receive_errors;
+        // Packets which arrived after the detection had finished.
+        MetricCounter dropped_packets;
+        MetricHistogram packet_bytes;
+        MetricHistogram callback_ns;
+    };
+
+    struct InterfaceMetrics {
+        MetricCounter packets;
+        MetricCounter bytes;
+    };
+
+    static ReceiveMetrics CreateReceiveMetrics();
+
+private:
+    ReceiveMetrics metrics_;
+    HandlerTrackingMetrics receive_handler_metrics_;
+    MetricGauge group_sockets_;
+    // Packets per local subnet, and from senders on none of them.
+    std::vector<MetricCounter> subnet_packets_;
+    MetricCounter off_subnet_packets_;
+    // Added to the gauges by SocketsOpened().
+    int64_t open_sockets_;
+    std::map<std::string, InterfaceMetrics> interface_metrics_;
+    std::unique_ptr<PacketTracer> packet_tracer_;
+    bool perf_counters_enabled_;
+    // Opened on the detect thread, which it counts.
+    std::unique_ptr<PerfCounterGroup> perf_counters_;
+    PerfMetrics perf_metrics_;
+};
+
+// MetricsPolicy: measures nothing, every hook is an empty inline function.
+class NullMetricsPolicy {
+public:
+    static constexpr bool kSubnetAccounting = false;
+
+    struct ProfileScope {
+        explicit ProfileScope(const NullMetricsPolicy&) {}
+    };
+
+protected:
+    bool TracingEnabled() const { return false; }
+    bool SampleTrace() { return false; }
+    uint64_t TraceCount() const { return 0; }
+    void RecordTrace(const PacketTrace&) {}
+
+    void OpenPerfCounters() {}
+
+    template <typename Handler>
+    Handler WrapReceiveHandler(Handler handler) const {
+        return handler;
+    }
+
+    void InterfaceAdded(const std::string&) {}
+    void SocketsOpened(size_t, const std::string&) {}
+    void SocketsClosed() {}
+    void SocketError() {}
+    void ReceivePosted() {}
+    void ReceiveError() {}
+    void PacketDropped() {}
+    void PacketReceived(const std::string&, size_t) {}
+    void SubnetAdded(uint32_t, uint8_t) {}
+    void SenderClassified(uint16_t) const {}
+
+    uint64_t CallbackStart() const { return 0; }
+    void CallbackDone(uint64_t) const {}
+};
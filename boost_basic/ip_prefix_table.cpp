@@ -0,0 +1,101 @@
+#include "ip_prefix_table.h"
+
+#include <algorithm>
+#include <boost/asio/ip/address_v4.hpp>
+
+#include "logger.h"
+
+constexpr uint16_t IpV4PrefixTable::kNoMatch;
+constexpr uint16_t IpV4PrefixTable::kMaxValue;
+constexpr uint16_t IpV4PrefixTable::kGroupFlag;
+constexpr uint16_t IpV4PrefixTable::kIndexMask;
+
+IpV4PrefixTable::IpV4PrefixTable() {
+}
+
+bool IpV4PrefixTable::AddRoute(uint32_t prefix, uint8_t prefix_length, uint16_t value) {
+    if (prefix_length > 32 || value > kMaxValue) {
+        return false;
+    }
+    const uint32_t mask = prefix_length == 0 ? 0 : (0xFFFFFFFFu << (32 - prefix_length));
+    routes_.push_back({ prefix & mask, prefix_length, value });
+    return true;
+}
+
+void IpV4PrefixTable::Clear() {
+    routes_.clear();
+    Build();
+}
+
+void IpV4PrefixTable::Build() {
+    groups_.clear();
+    if (routes_.empty()) {
+        std::vector<uint16_t>().swap(root_);
+        return;
+    }
+    root_.assign(1 << 16, kNoMatch);
+
+    // Shorter prefixes first, so a longer prefix always overwrites the
+    // entries it covers and new groups inherit the covering value.
+    std::stable_sort(routes_.begin(), routes_.end(),
+        [](const Route& left, const Route& right) {
+            return left.prefix_length < right.prefix_length;
+        });
+    for (auto iter = routes_.begin(); iter != routes_.end(); ++iter) {
+        Insert(*iter);
+    }
+}
+
+void IpV4PrefixTable::Insert(const Route& route) {
+    // Level 0 covers bits 31..16, level 1 bits 15..8 and level 2 bits 7..0.
+    uint16_t* entries = root_.data();
+    uint32_t index = route.prefix >> 16;
+    uint8_t level_end = 16;
+    while (route.prefix_length > level_end) {
+        const uint16_t group = ExpandEntry(&entries[index]);
+        entries = &groups_[static_cast<size_t>(group) << 8];
+        index = (route.prefix >> (24 - level_end)) & 0xFF;
+        level_end += 8;
+    }
+
+    const uint32_t count = 1u << (level_end - route.prefix_length);
+    for (uint32_t i = 0; i < count; ++i) {
+        entries[index + i] = route.value;
+    }
+}
+
+uint16_t IpV4PrefixTable::ExpandEntry(uint16_t* entry) {
+    if (*entry & kGroupFlag) {
+        return *entry & kIndexMask;
+    }
+    // |entry| may point into groups_, read it before the resize.
+    const uint16_t value = *entry;
+    const size_t group = groups_.size() >> 8;
+    const ptrdiff_t offset = entry - groups_.data();
+    const bool in_groups = !groups_.empty() && offset >= 0 &&
+        static_cast<size_t>(offset) < groups_.size();
+    groups_.resize(groups_.size() + 256, value);
+    if (in_groups) {
+        entry = groups_.data() + offset;
+    }
+    *entry = static_cast<uint16_t>(kGroupFlag | group);
+    return static_cast<uint16_t>(group);
+}
+
+void TestIpPrefixTable() {
+    using boost::asio::ip::address_v4;
+    IpV4PrefixTable table;
+    table.AddRoute(address_v4::from_string("10.0.0.0").to_ulong(), 8, 1);
+    table.AddRoute(address_v4::from_string("10.1.0.0").to_ulong(), 16, 2);
+    table.AddRoute(address_v4::from_string("10.1.2.0").to_ulong(), 24, 3);
+    table.AddRoute(address_v4::from_string("10.1.2.128").to_ulong(), 25, 4);
+    table.AddRoute(address_v4::from_string("192.168.1.7").to_ulong(), 32, 5);
+    table.Build();
+
+    const char* ips[] = { "10.9.9.9", "10.1.9.9", "10.1.2.3", "10.1.2.200",
+        "192.168.1.7", "192.168.1.8" };
+    for (size_t i = 0; i < sizeof(ips) / sizeof(ips[0]); ++i) {
+        LOG_INFO << ips[i] << " matches route "
+            << table.Lookup(address_v4::from_string(ips[i]).to_ulong()) << ENDLINE;
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Longest prefix match table for ip v4 addresses. The lookup is a fixed
+// 16-8-8 stride trie with leaf pushing (DIR-16-8-8), so one address takes
+// at most three dependent loads:
+//   root_   : 64K entries indexed by the top 16 bits.
+//   groups_ : 256 entry groups indexed by the next 8 bits.
+// An entry is either a value or, with kGroupFlag set, the index of a group.
+// The 128 KB root is only allocated by a Build() with routes, an empty
+// table matches nothing.
+class IpV4PrefixTable {
+public:
+    static constexpr uint16_t kNoMatch = 0x7FFF;
+    static constexpr uint16_t kMaxValue = 0x7FFE;
+
+    IpV4PrefixTable();
+
+    // |prefix| is in host byte order, bits beyond |prefix_length| are
+    // ignored. Returns false if the value or the prefix length is invalid.
+    bool AddRoute(uint32_t prefix, uint8_t prefix_length, uint16_t value);
+    void Clear();
+    bool Empty() const { return routes_.empty(); }
+
+    // Rebuild the trie after the routes have been changed.
+    void Build();
+
+    uint16_t Lookup(uint32_t ip) const {
+        if (root_.empty()) {
+            return kNoMatch;
+        }
+        uint16_t entry = root_[ip >> 16];
+        if (entry & kGroupFlag) {
+            entry = groups_[((entry & kIndexMask) << 8) | ((ip >> 8) & 0xFF)];
+            if (entry & kGroupFlag) {
+                entry = groups_[((entry & kIndexMask) << 8) | (ip & 0xFF)];
+            }
+        }
+        return entry;
+    }
+
+private:
+    static constexpr uint16_t kGroupFlag = 0x8000;
+    static constexpr uint16_t kIndexMask = 0x7FFF;
+
+    struct Route {
+        uint32_t prefix;
+        uint8_t prefix_length;
+        uint16_t value;
+    };
+
+    void Insert(const Route& route);
+    uint16_t ExpandEntry(uint16_t* entry);
+
+private:
+    std::vector<Route> routes_;
+    std::vector<uint16_t> root_;
+    std::vector<uint16_t> groups_;
+};
+
+void TestIpPrefixTable();
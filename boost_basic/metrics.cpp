@@ -0,0 +1,178 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "logger.h"
+
+MetricsRegistry& MetricsRegistry::Instance() {
+    static MetricsRegistry* instance = new MetricsRegistry();
+    return *instance;
+}
+
+MetricsRegistry::MetricsRegistry() : used_slots_(0), used_gauges_(0) {
+    for (uint32_t i = 0; i < kMaxGauges; ++i) {
+        gauges_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+MetricsRegistry::Shard::Shard() {
+    for (uint32_t i = 0; i < kMaxSlots; ++i) {
+        values[i].store(0, std::memory_order_relaxed);
+    }
+    in_use.store(true, std::memory_order_relaxed);
+}
+
+MetricsRegistry::ShardHolder::~ShardHolder() {
+    if (shard) {
+        shard->in_use.store(false, std::memory_order_release);
+    }
+}
+
+MetricsRegistry::Shard* MetricsRegistry::AcquireShard() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto iter = shards_.begin(); iter != shards_.end(); ++iter) {
+        bool in_use = false;
+        if ((*iter)->in_use.compare_exchange_strong(in_use, true)) {
+            return *iter;
+        }
+    }
+    shards_.push_back(new Shard());
+    return shards_.back();
+}
+
+const MetricsRegistry::Metric* MetricsRegistry::FindMetric(const std::string& name,
+                                                           MetricKind kind) const {
+    for (auto iter = metrics_.begin(); iter != metrics_.end(); ++iter) {
+        if (iter->name == name) {
+            return iter->kind == kind ? &*iter : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+MetricCounter MetricsRegistry::AddCounter(const std::string& name, const std::string& help) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Metric* existing = FindMetric(name, kMetricCounter);
+    if (existing) {
+        return MetricCounter(existing->index);
+    }
+    if (used_slots_ == kMaxSlots) {
+        LOG_ERROR << "No metric slot left for " << name << ENDLINE;
+        return MetricCounter();
+    }
+    const Metric metric = { name, help, kMetricCounter, used_slots_++, nullptr };
+    metrics_.push_back(metric);
+    return MetricCounter(metric.index);
+}
+
+MetricGauge MetricsRegistry::AddGauge(const std::string& name, const std::string& help) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Metric* existing = FindMetric(name, kMetricGauge);
+    if (existing) {
+        return MetricGauge(&gauges_[existing->index]);
+    }
+    if (used_gauges_ == kMaxGauges) {
+        LOG_ERROR << "No metric gauge left for " << name << ENDLINE;
+        return MetricGauge();
+    }
+    const Metric metric = { name, help, kMetricGauge, used_gauges_++, nullptr };
+    metrics_.push_back(metric);
+    return MetricGauge(&gauges_[metric.index]);
+}
+
+MetricHistogram MetricsRegistry::AddHistogram(const std::string& name,
+                                              const std::string& help,
+                                              const std::vector<uint64_t>& bounds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Metric* existing = FindMetric(name, kMetricHistogram);
+    if (existing) {
+        return MetricHistogram(existing->index, existing->bounds->data(),
+            static_cast<uint32_t>(existing->bounds->size()));
+    }
+    // The buckets, one for the values above the bounds and the sum.
+    const uint32_t slots = static_cast<uint32_t>(bounds.size()) + 2;
+    if (kMaxSlots - used_slots_ < slots) {
+        LOG_ERROR << "No metric slot left for " << name << ENDLINE;
+        return MetricHistogram();
+    }
+    bounds_.push_back(bounds);
+    std::sort(bounds_.back().begin(), bounds_.back().end());
+    const Metric metric = { name, help, kMetricHistogram, used_slots_, &bounds_.back() };
+    used_slots_ += slots;
+    metrics_.push_back(metric);
+    return MetricHistogram(metric.index, metric.bounds->data(),
+        static_cast<uint32_t>(metric.bounds->size()));
+}
+
+uint64_t MetricsRegistry::SumSlot(uint32_t slot) const {
+    uint64_t sum = 0;
+    for (auto iter = shards_.begin(); iter != shards_.end(); ++iter) {
+        sum += (*iter)->values[slot].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+std::vector<MetricSnapshot> MetricsRegistry::Snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<MetricSnapshot> snapshots;
+    snapshots.reserve(metrics_.size());
+    for (auto iter = metrics_.begin(); iter != metrics_.end(); ++iter) {
+        MetricSnapshot snapshot;
+        snapshot.name = iter->name;
+        snapshot.help = iter->help;
+        snapshot.kind = iter->kind;
+        snapshot.value = 0;
+        snapshot.count = 0;
+        snapshot.sum = 0;
+        switch (iter->kind) {
+        case kMetricCounter:
+            snapshot.value = static_cast<int64_t>(SumSlot(iter->index));
+            break;
+        case kMetricGauge:
+            snapshot.value = gauges_[iter->index].load(std::memory_order_relaxed);
+            break;
+        case kMetricHistogram: {
+            const uint32_t bound_count = static_cast<uint32_t>(iter->bounds->size());
+            snapshot.bounds = *iter->bounds;
+            for (uint32_t i = 0; i <= bound_count; ++i) {
+                snapshot.buckets.push_back(SumSlot(iter->index + i));
+                snapshot.count += snapshot.buckets.back();
+            }
+            snapshot.sum = SumSlot(iter->index + bound_count + 1);
+            break;
+        }
+        }
+        snapshots.push_back(snapshot);
+    }
+    return snapshots;
+}
+
+void TestMetricsRegistry() {
+    MetricsRegistry& registry = MetricsRegistry::Instance();
+    const MetricCounter counter = registry.AddCounter("test_events_total", "Test events");
+    const MetricHistogram histogram = registry.AddHistogram("test_sizes", "Test sizes",
+        { 64, 256, 1024 });
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.push_back(std::thread([&counter, &histogram, t]() {
+            for (uint64_t i = 0; i < 100000; ++i) {
+                counter.Add();
+                histogram.Observe((i * (t + 1)) % 2000);
+            }
+        }));
+    }
+    for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+        iter->join();
+    }
+
+    const std::vector<MetricSnapshot> snapshots = registry.Snapshot();
+    for (auto iter = snapshots.begin(); iter != snapshots.end(); ++iter) {
+        if (iter->kind == kMetricHistogram) {
+            LOG_INFO << iter->name << " count " << iter->count << " sum " << iter->sum << ENDLINE;
+        }
+        else {
+            LOG_INFO << iter->name << " " << iter->value << ENDLINE;
+        }
+    }
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Process-wide registry of counters, gauges and histograms. Counters and
+// histograms live in per thread shards, an update is a relaxed load and
+// store on the calling thread's own cache lines, never a locked instruction.
+// A read sums the shards, so it is only as fresh as the last update each
+// thread has made visible.
+//
+//   static const MetricCounter packets = MetricsRegistry::Instance().AddCounter(
+//       "ip_detector_packets_total", "Packets received");
+//   packets.Add();
+//
+// Registering a name twice returns the first metric, so the handles can be
+// created by every instance of a class.
+
+enum MetricKind {
+    kMetricCounter,
+    kMetricGauge,
+    kMetricHistogram
+};
+
+class MetricCounter {
+public:
+    MetricCounter() : slot_(kInvalidSlot) {}
+    explicit MetricCounter(uint32_t slot) : slot_(slot) {}
+
+    inline void Add(uint64_t value = 1) const;
+
+private:
+    static constexpr uint32_t kInvalidSlot = 0xFFFFFFFF;
+    uint32_t slot_;
+};
+
+// A single value for the whole process, set rarely so it isn't sharded.
+class MetricGauge {
+public:
+    MetricGauge() : value_(nullptr) {}
+    explicit MetricGauge(std::atomic<int64_t>* value) : value_(value) {}
+
+    void Set(int64_t value) const {
+        if (value_) {
+            value_->store(value, std::memory_order_relaxed);
+        }
+    }
+
+    void Add(int64_t value) const {
+        if (value_) {
+            value_->fetch_add(value, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::atomic<int64_t>* value_;
+};
+
+// Counts the observations into fixed buckets, bucket i counts the values
+// up to bounds[i] and the last one the values above all the bounds.
+class MetricHistogram {
+public:
+    MetricHistogram() : first_slot_(kInvalidSlot), bounds_(nullptr), bound_count_(0) {}
+    MetricHistogram(uint32_t first_slot, const uint64_t* bounds, uint32_t bound_count)
+        : first_slot_(first_slot), bounds_(bounds), bound_count_(bound_count) {}
+
+    inline void Observe(uint64_t value) const;
+
+private:
+    static constexpr uint32_t kInvalidSlot = 0xFFFFFFFF;
+    uint32_t first_slot_;
+    const uint64_t* bounds_;
+    uint32_t bound_count_;
+};
+
+struct MetricSnapshot {
+    std::string name;
+    std::string help;
+    MetricKind kind;
+    // Counter total or gauge value.
+    int64_t value;
+    // Histograms only, |buckets| has one more entry than |bounds|.
+    std::vector<uint64_t> bounds;
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+    uint64_t sum;
+};
+
+class MetricsRegistry {
+public:
+    static constexpr uint32_t kMaxSlots = 1024;
+    static constexpr uint32_t kMaxGauges = 64;
+
+    // Never destroyed, the handles may be used from static destructors.
+    static MetricsRegistry& Instance();
+
+    // The names may carry Prometheus labels, e.g. packets_total{interface="eth0"}.
+    // Once the registry is full an inert handle is returned.
+    MetricCounter AddCounter(const std::string& name, const std::string& help);
+    MetricGauge AddGauge(const std::string& name, const std::string& help);
+    MetricHistogram AddHistogram(const std::string& name, const std::string& help,
+                                 const std::vector<uint64_t>& bounds);
+
+    // Sums the shards of all the threads, in registration order.
+    std::vector<MetricSnapshot> Snapshot() const;
+
+    // Updates of the calling thread, see MetricCounter and MetricHistogram.
+    static void AddToSlot(uint32_t slot, uint64_t value) {
+        std::atomic<uint64_t>& target = ThreadShard()->values[slot];
+        target.store(target.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+private:
+    // Padded on both sides so no other allocation shares its cache lines.
+    struct Shard {
+        Shard();
+
+        char leading_padding[64];
+        std::atomic<uint64_t> values[kMaxSlots];
+        std::atomic<bool> in_use;
+        char trailing_padding[64];
+    };
+
+    struct ShardHolder {
+        ShardHolder() : shard(nullptr) {}
+        ~ShardHolder();
+        Shard* shard;
+    };
+
+    struct Metric {
+        std::string name;
+        std::string help;
+        MetricKind kind;
+        uint32_t index;
+        const std::vector<uint64_t>* bounds;
+    };
+
+    MetricsRegistry();
+
+    static Shard* ThreadShard() {
+        static thread_local ShardHolder holder;
+        if (!holder.shard) {
+            holder.shard = Instance().AcquireShard();
+        }
+        return holder.shard;
+    }
+
+    Shard* AcquireShard();
+    const Metric* FindMetric(const std::string& name, MetricKind kind) const;
+    uint64_t SumSlot(uint32_t slot) const;
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<Metric> metrics_;
+    uint32_t used_slots_;
+    std::deque<std::vector<uint64_t>> bounds_;
+    std::atomic<int64_t> gauges_[kMaxGauges];
+    uint32_t used_gauges_;
+    // Shards are kept after their thread exits, the counts stay in the
+    // totals and a new thread continues in it.
+    std::vector<Shard*> shards_;
+};
+
+inline void MetricCounter::Add(uint64_t value) const {
+    if (slot_ != kInvalidSlot) {
+        MetricsRegistry::AddToSlot(slot_, value);
+    }
+}
+
+inline void MetricHistogram::Observe(uint64_t value) const {
+    if (first_slot_ == kInvalidSlot) {
+        return;
+    }
+    uint32_t bucket = 0;
+    while (bucket < bound_count_ && value > bounds_[bucket]) {
+        ++bucket;
+    }
+    MetricsRegistry::AddToSlot(first_slot_ + bucket, 1);
+    MetricsRegistry::AddToSlot(first_slot_ + bound_count_ + 1, value);
+}
+
+void TestMetricsRegistry();
@@ -0,0 +1,145 @@
+#include "metrics_shm_exporter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "logger.h"
+#include "metrics.h"
+
+MetricsShmExporter::MetricsShmExporter(const std::string& name)
+    : name_(name),
+    segment_(nullptr),
+    stop_publish_(false) {
+}
+
+MetricsShmExporter::~MetricsShmExporter() {
+    Stop();
+    if (segment_) {
+        boost::interprocess::mapped_region().swap(region_);
+        boost::interprocess::shared_memory_object::remove(name_.c_str());
+    }
+}
+
+bool MetricsShmExporter::Start(std::chrono::milliseconds interval) {
+    Stop();
+    if (!segment_ && !CreateSegment()) {
+        return false;
+    }
+    Publish();
+    {
+        std::lock_guard<std::mutex> lock(publish_mutex_);
+        stop_publish_ = false;
+    }
+    publish_thread_ = std::thread(&MetricsShmExporter::PublishLoop, this, interval);
+    return true;
+}
+
+void MetricsShmExporter::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(publish_mutex_);
+        stop_publish_ = true;
+    }
+    publish_cv_.notify_all();
+    if (publish_thread_.joinable()) {
+        publish_thread_.join();
+    }
+}
+
+bool MetricsShmExporter::CreateSegment() {
+    namespace ipc = boost::interprocess;
+    try {
+        ipc::shared_memory_object shared_memory(ipc::open_or_create, name_.c_str(),
+            ipc::read_write);
+        shared_memory.truncate(sizeof(MetricsShmSegment));
+        ipc::mapped_region region(shared_memory, ipc::read_write, 0, sizeof(MetricsShmSegment));
+        region_.swap(region);
+    }
+    catch (const ipc::interprocess_exception& e) {
+        LOG_ERROR << "Create metrics shared memory " << name_ << " failed: " << e.what()
+            << ENDLINE;
+        return false;
+    }
+
+    // A segment left by a crashed process is reset, readers see the bad
+    // magic until the header is complete.
+    segment_ = static_cast<MetricsShmSegment*>(region_.get_address());
+    memset(segment_->magic, 0, sizeof(segment_->magic));
+    segment_->version = kMetricsShmVersion;
+    segment_->entry_size = sizeof(MetricsShmEntry);
+    segment_->sequence.store(0, std::memory_order_relaxed);
+    segment_->metric_count = 0;
+    segment_->publish_count = 0;
+    segment_->publish_realtime_ns = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(segment_->magic, kMetricsShmMagic, sizeof(segment_->magic));
+    return true;
+}
+
+void MetricsShmExporter::Publish() {
+    if (!segment_) {
+        return;
+    }
+    const std::vector<MetricSnapshot> snapshots = MetricsRegistry::Instance().Snapshot();
+    const uint32_t count = static_cast<uint32_t>(
+        std::min<size_t>(snapshots.size(), kMaxShmMetrics));
+
+    const uint32_t sequence = segment_->sequence.load(std::memory_order_relaxed);
+    segment_->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const MetricSnapshot& snapshot = snapshots[i];
+        MetricsShmEntry& entry = segment_->entries[i];
+        const size_t name_length = std::min<size_t>(snapshot.name.size(),
+            kShmMetricNameLength - 1);
+        memcpy(entry.name, snapshot.name.data(), name_length);
+        entry.name[name_length] = '\0';
+        entry.kind = static_cast<uint32_t>(snapshot.kind);
+        entry.value = snapshot.value;
+        entry.count = snapshot.count;
+        entry.sum = snapshot.sum;
+        // Extra bounds are folded into the last bucket.
+        const uint32_t bound_count = static_cast<uint32_t>(
+            std::min<size_t>(snapshot.bounds.size(), kMaxShmBounds));
+        entry.bound_count = bound_count;
+        for (uint32_t j = 0; j < bound_count; ++j) {
+            entry.bounds[j] = snapshot.bounds[j];
+            entry.buckets[j] = snapshot.buckets[j];
+        }
+        entry.buckets[bound_count] = 0;
+        for (size_t j = bound_count; j < snapshot.buckets.size(); ++j) {
+            entry.buckets[bound_count] += snapshot.buckets[j];
+        }
+    }
+    segment_->metric_count = count;
+    ++segment_->publish_count;
+    segment_->publish_realtime_ns = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+
+    segment_->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void MetricsShmExporter::PublishLoop(std::chrono::milliseconds interval) {
+    std::unique_lock<std::mutex> lock(publish_mutex_);
+    while (!publish_cv_.wait_for(lock, interval, [this]() { return stop_publish_; })) {
+        lock.unlock();
+        Publish();
+        lock.lock();
+    }
+}
+
+void TestMetricsShmExporter() {
+    MetricsShmExporter exporter;
+    if (!exporter.Start(std::chrono::milliseconds(100))) {
+        return;
+    }
+    LOG_INFO << "Run metrics_reader " << kDefaultMetricsShmName << " meanwhile." << ENDLINE;
+    const MetricCounter counter = MetricsRegistry::Instance().AddCounter(
+        "test_exported_total", "Test events exported to shared memory");
+    for (int i = 0; i < 100; ++i) {
+        counter.Add();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
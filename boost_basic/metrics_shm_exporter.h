@@ -0,0 +1,45 @@
+#pragma once
+
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "metrics_shm_format.h"
+
+// Publishes the MetricsRegistry into a named shared memory segment, see
+// metrics_shm_format.h. The publication runs on its own thread, the
+// threads updating the metrics are never touched, and a reader in another
+// process samples the segment without any call into this process.
+class MetricsShmExporter {
+public:
+    explicit MetricsShmExporter(const std::string& name = kDefaultMetricsShmName);
+    // Stops the publication and removes the segment.
+    ~MetricsShmExporter();
+
+    // Creates the segment and publishes every |interval|.
+    bool Start(std::chrono::milliseconds interval);
+    void Stop();
+
+    // Publishes the current values once, Start() has to have succeeded.
+    void Publish();
+
+private:
+    bool CreateSegment();
+    void PublishLoop(std::chrono::milliseconds interval);
+
+private:
+    std::string name_;
+    boost::interprocess::mapped_region region_;
+    MetricsShmSegment* segment_;
+
+    std::mutex publish_mutex_;
+    std::condition_variable publish_cv_;
+    bool stop_publish_;
+    std::thread publish_thread_;
+};
+
+void TestMetricsShmExporter();
@@ -0,0 +1,47 @@
+#pragma once
+
+// Layout of the shared memory segment the metrics are exported to, shared
+// by MetricsShmExporter and the metrics_reader tool. The segment is one
+// MetricsShmSegment, all the fields are in the byte order of the host.
+//
+// The exporter is the only writer and guards every publication with a
+// sequence lock: |sequence| is odd while the entries are written. A reader
+// copies the segment and retries while the sequence was odd or changed, so
+// the writer never waits on a reader.
+
+#include <atomic>
+#include <stdint.h>
+
+const char kMetricsShmMagic[8] = { 'I', 'P', 'D', 'M', 'E', 'T', 'R', 'C' };
+constexpr uint32_t kMetricsShmVersion = 1;
+const char kDefaultMetricsShmName[] = "ip_detector_metrics";
+
+constexpr uint32_t kMaxShmMetrics = 256;
+constexpr uint32_t kMaxShmBounds = 16;
+constexpr uint32_t kShmMetricNameLength = 128;
+
+struct MetricsShmEntry {
+    // Zero terminated, may be truncated.
+    char name[kShmMetricNameLength];
+    // One of MetricKind.
+    uint32_t kind;
+    uint32_t bound_count;
+    // Counter total or gauge value.
+    int64_t value;
+    // Histograms only, buckets has bound_count + 1 entries used.
+    uint64_t count;
+    uint64_t sum;
+    uint64_t bounds[kMaxShmBounds];
+    uint64_t buckets[kMaxShmBounds + 1];
+};
+
+struct MetricsShmSegment {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    std::atomic<uint32_t> sequence;
+    uint32_t metric_count;
+    uint64_t publish_count;
+    uint64_t publish_realtime_ns;
+    MetricsShmEntry entries[kMaxShmMetrics];
+};
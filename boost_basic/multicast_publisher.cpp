@@ -0,0 +1,388 @@
+#include "multicast_publisher.h"
+
+#include <sstream>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#endif
+
+#include "ip_address_classifier.h"
+#include "logger.h"
+#include "tsc_clock.h"
+
+#if defined(__linux__) && !defined(UDP_SEGMENT)
+// linux/udp.h of 4.18, older libc headers lack it.
+#define UDP_SEGMENT 103
+#endif
+
+#if defined(__linux__) && !defined(SO_TXTIME)
+// asm-generic/socket.h of 4.19.
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+namespace {
+    constexpr int kSendBufferSize = 1000 * 1024;
+    // 0xFFFF less the ip and UDP headers.
+    constexpr size_t kMaxSegmentedBytes = 65507;
+
+#if defined(__linux__)
+    // struct sock_txtime of linux/net_tstamp.h.
+    struct SocketTxTime {
+        clockid_t clockid;
+        uint32_t flags;
+    };
+
+    bool EnableTxTime(int fd) {
+        SocketTxTime txtime = { CLOCK_MONOTONIC, 0 };
+        return setsockopt(fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) == 0;
+    }
+#endif
+}
+
+constexpr size_t MulticastPublisher::kMaxBatch;
+constexpr size_t MulticastPublisher::kMaxSegments;
+constexpr uint64_t MulticastPublisher::kSendErrorLogsPerSecond;
+
+struct MulticastPublisher::Socket {
+    explicit Socket(boost::asio::io_service& io_service)
+        : socket(io_service), segmentation(false), txtime(false),
+        max_segment_size(kMaxSegmentedBytes) {}
+
+    std::string ip;
+    boost::asio::ip::udp::socket socket;
+    bool segmentation;
+    bool txtime;
+    // A segment has to fit the mtu, larger packets are sent unsegmented and
+    // fragmented. Lowered on the first segment the kernel refuses.
+    size_t max_segment_size;
+#if defined(__linux__)
+    // Reused by every batch, so a send doesn't allocate.
+    struct mmsghdr messages[kMaxBatch];
+    struct iovec iovecs[kMaxBatch * kMaxSegments];
+    size_t message_packets[kMaxBatch];
+    size_t message_bytes[kMaxBatch];
+    union {
+        char buffer[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t))];
+        struct cmsghdr align;
+    } controls[kMaxBatch];
+#endif
+};
+
+MulticastPublisher::MulticastPublisher(const std::string& multicast_ip, uint16_t multicast_port,
+                                       const MulticastPublisherOptions& options)
+    : ip_address_pool_(IpAddressPool::GetSharedPool()),
+    options_(options),
+    stats_start_ns_(0),
+    packets_metric_(MetricsRegistry::Instance().AddCounter(
+        "multicast_publisher_packets_total", "Packets published")),
+    bytes_metric_(MetricsRegistry::Instance().AddCounter(
+        "multicast_publisher_bytes_total", "Bytes published")),
+    errors_metric_(MetricsRegistry::Instance().AddCounter(
+        "multicast_publisher_send_errors_total", "Sends failed")) {
+    boost::system::error_code ec;
+    destination_ = boost::asio::ip::udp::endpoint(
+        boost::asio::ip::address::from_string(multicast_ip, ec), multicast_port);
+    if (ec) {
+        LOG_ERROR << "Invalid multicast ip " << multicast_ip << ENDLINE;
+    }
+#if !defined(__linux__)
+    options_.batching = false;
+#endif
+    options_.segmentation = options_.segmentation && options_.batching;
+    options_.txtime = options_.txtime && options_.batching;
+    // Send() times every call.
+    logger::TscClock::WarmUp();
+}
+
+MulticastPublisher::~MulticastPublisher() {
+    Close();
+}
+
+size_t MulticastPublisher::OpenAllInterfaces() {
+    auto ip_v4_list = ip_address_pool_->GetIpV4InterfaceList();
+    size_t opened = 0;
+    for (size_t i = 0; i < ip_v4_list.size(); ++i) {
+        // As in IpDetector, these can't be the interface of a group.
+        const uint8_t ip_class = ClassifyIpAddress(ip_v4_list[i].ip);
+        if (ip_class & (kIpClassUnspecified | kIpClassLoopback | kIpClassMulticast)) {
+            continue;
+        }
+        if (OpenInterface(ip_v4_list[i].ip)) {
+            ++opened;
+        }
+    }
+    return opened;
+}
+
+bool MulticastPublisher::OpenInterface(const std::string& local_ip) {
+    boost::system::error_code ec;
+    const boost::asio::ip::address_v4 local_address =
+        boost::asio::ip::address_v4::from_string(local_ip, ec);
+    if (ec) {
+        LOG_ERROR << "Invalid local ip " << local_ip << ENDLINE;
+        return false;
+    }
+
+    std::unique_ptr<Socket> socket(new Socket(io_service_));
+    socket->socket.open(boost::asio::ip::udp::v4(), ec);
+    if (ec) {
+        LOG_ERROR << "Open socket failed! " << ec.message() << ENDLINE;
+        return false;
+    }
+    socket->socket.set_option(boost::asio::ip::multicast::outbound_interface(local_address), ec);
+    if (ec) {
+        LOG_ERROR << local_ip << " set multicast interface failed! Error code : " << ec << ENDLINE;
+        return false;
+    }
+    socket->socket.set_option(boost::asio::ip::multicast::hops(options_.ttl), ec);
+    if (ec) {
+        LOG_ERROR << "Set multicast ttl " << options_.ttl << " failed! Error code : " << ec << ENDLINE;
+        return false;
+    }
+    socket->socket.set_option(boost::asio::ip::multicast::enable_loopback(options_.loopback), ec);
+    if (ec) {
+        LOG_ERROR << "Set multicast loopback failed! Error code : " << ec << ENDLINE;
+        return false;
+    }
+    socket->socket.set_option(boost::asio::socket_base::send_buffer_size(kSendBufferSize), ec);
+
+    socket->ip = local_ip;
+    socket->segmentation = options_.segmentation;
+#if defined(__linux__)
+    if (options_.txtime) {
+        socket->txtime = EnableTxTime(socket->socket.native_handle());
+        if (!socket->txtime) {
+            LOG_WARN << "SO_TXTIME unsupported on " << local_ip << ", " << strerror(errno)
+                << ", packets leave when sent" << ENDLINE;
+        }
+    }
+#endif
+    LOG_INFO << "Publishing to " << destination_ << " on " << local_ip << ENDLINE;
+    sockets_.push_back(std::move(socket));
+    return true;
+}
+
+bool MulticastPublisher::TxTimeEnabled() const {
+    for (auto iter = sockets_.begin(); iter != sockets_.end(); ++iter) {
+        if (!(*iter)->txtime) {
+            return false;
+        }
+    }
+    return !sockets_.empty();
+}
+
+void MulticastPublisher::Close() {
+    boost::system::error_code ec;
+    for (auto iter = sockets_.begin(); iter != sockets_.end(); ++iter) {
+        (*iter)->socket.close(ec);
+    }
+    sockets_.clear();
+}
+
+size_t MulticastPublisher::Send(const boost::asio::const_buffer* packets, size_t count) {
+    return Send(packets, nullptr, count);
+}
+
+size_t MulticastPublisher::Send(const boost::asio::const_buffer* packets,
+                                const uint64_t* departure_ns, size_t count) {
+    const uint64_t now = logger::TscClock::Instance().NowNanoseconds();
+    if (stats_start_ns_ == 0) {
+        stats_start_ns_ = now;
+    }
+    size_t sent = 0;
+    for (auto iter = sockets_.begin(); iter != sockets_.end(); ++iter) {
+        sent = SendOn(**iter, packets, departure_ns, count);
+    }
+    stats_.nanoseconds = logger::TscClock::Instance().NowNanoseconds() - stats_start_ns_;
+    return sent;
+}
+
+size_t MulticastPublisher::SendOn(Socket& socket, const boost::asio::const_buffer* packets,
+                                  const uint64_t* departure_ns, size_t count) {
+    return options_.batching ? SendBatches(socket, packets, departure_ns, count) :
+        SendEach(socket, packets, count);
+}
+
+size_t MulticastPublisher::SendBatches(Socket& socket, const boost::asio::const_buffer* packets,
+                                       const uint64_t* departure_ns, size_t count) {
+#if defined(__linux__)
+    // Every packet has its own departure time, so none is segmented.
+    const bool txtime = departure_ns != nullptr && socket.txtime;
+    const boost::asio::ip::udp::endpoint::data_type* destination = destination_.data();
+    size_t sent = 0;
+    while (sent < count) {
+        // Fills up to kMaxBatch messages, each with one packet or with a run
+        // of segments of the first packet's size, the last may be shorter.
+        size_t message_count = 0;
+        size_t iovec_count = 0;
+        size_t next = sent;
+        while (message_count < kMaxBatch && next < count) {
+            struct mmsghdr& message = socket.messages[message_count];
+            memset(&message, 0, sizeof(message));
+            message.msg_hdr.msg_name = const_cast<boost::asio::ip::udp::endpoint::data_type*>(destination);
+            message.msg_hdr.msg_namelen = static_cast<socklen_t>(destination_.size());
+            message.msg_hdr.msg_iov = &socket.iovecs[iovec_count];
+
+            const size_t first = next;
+            const size_t segment_size = boost::asio::buffer_size(packets[next]);
+            size_t segments = 0;
+            size_t bytes = 0;
+            for (;;) {
+                const size_t size = boost::asio::buffer_size(packets[next]);
+                struct iovec& iovec = socket.iovecs[iovec_count++];
+                iovec.iov_base = const_cast<void*>(boost::asio::buffer_cast<const void*>(packets[next]));
+                iovec.iov_len = size;
+                bytes += size;
+                ++segments;
+                ++next;
+                if (!socket.segmentation || txtime || segment_size == 0 ||
+                    segment_size > socket.max_segment_size || size != segment_size ||
+                    next == count || segments == kMaxSegments ||
+                    boost::asio::buffer_size(packets[next]) > segment_size ||
+                    bytes + boost::asio::buffer_size(packets[next]) > kMaxSegmentedBytes) {
+                    break;
+                }
+            }
+            message.msg_hdr.msg_iovlen = segments;
+            const size_t control_length = (segments > 1 ? CMSG_SPACE(sizeof(uint16_t)) : 0) +
+                (txtime ? CMSG_SPACE(sizeof(uint64_t)) : 0);
+            if (control_length > 0) {
+                message.msg_hdr.msg_control = socket.controls[message_count].buffer;
+                message.msg_hdr.msg_controllen = control_length;
+                struct cmsghdr* control = CMSG_FIRSTHDR(&message.msg_hdr);
+                if (segments > 1) {
+                    control->cmsg_level = IPPROTO_UDP;
+                    control->cmsg_type = UDP_SEGMENT;
+                    control->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                    const uint16_t gso_size = static_cast<uint16_t>(segment_size);
+                    memcpy(CMSG_DATA(control), &gso_size, sizeof(gso_size));
+                    control = CMSG_NXTHDR(&message.msg_hdr, control);
+                }
+                if (txtime) {
+                    control->cmsg_level = SOL_SOCKET;
+                    control->cmsg_type = SCM_TXTIME;
+                    control->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+                    memcpy(CMSG_DATA(control), &departure_ns[first], sizeof(uint64_t));
+                }
+            }
+            socket.message_packets[message_count] = segments;
+            socket.message_bytes[message_count] = bytes;
+            ++message_count;
+        }
+
+        const int result = sendmmsg(socket.socket.native_handle(), socket.messages,
+            static_cast<unsigned int>(message_count), 0);
+        ++stats_.send_calls;
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // The first message failed, its segments exceed the mtu. The
+            // kernel refuses a segment larger than the mtu with EINVAL, so
+            // this is checked before taking EINVAL as no support at all.
+            if ((errno == EINVAL || errno == EMSGSIZE) && socket.message_packets[0] > 1) {
+                socket.max_segment_size = socket.messages[0].msg_hdr.msg_iov[0].iov_len - 1;
+                LOG_WARN << "UDP segments of " << socket.max_segment_size + 1 << " bytes exceed the mtu of "
+                    << socket.ip << ", sending them unsegmented" << ENDLINE;
+                continue;
+            }
+            // EIO if the device can't checksum the segments.
+            if (socket.segmentation && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT ||
+                                        errno == EOPNOTSUPP)) {
+                LOG_WARN << "UDP segmentation unsupported on " << socket.ip << ", "
+                    << strerror(errno) << ", sending unsegmented" << ENDLINE;
+                socket.segmentation = false;
+                continue;
+            }
+            SendFailed(socket.ip, strerror(errno));
+            return sent;
+        }
+        size_t packets_sent = 0;
+        size_t bytes_sent = 0;
+        for (int i = 0; i < result; ++i) {
+            packets_sent += socket.message_packets[i];
+            bytes_sent += socket.message_bytes[i];
+        }
+        sent += packets_sent;
+        Sent(packets_sent, bytes_sent);
+    }
+    return sent;
+#else
+    (void)departure_ns;
+    return SendEach(socket, packets, count);
+#endif
+}
+
+size_t MulticastPublisher::SendEach(Socket& socket, const boost::asio::const_buffer* packets,
+                                    size_t count) {
+    boost::system::error_code ec;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t bytes = socket.socket.send_to(
+            boost::asio::const_buffers_1(packets[i]), destination_, 0, ec);
+        ++stats_.send_calls;
+        if (ec) {
+            SendFailed(socket.ip, ec.message());
+            return i;
+        }
+        Sent(1, bytes);
+    }
+    return count;
+}
+
+void MulticastPublisher::Sent(size_t packets, size_t bytes) {
+    stats_.packets += packets;
+    stats_.bytes += bytes;
+    packets_metric_.Add(packets);
+    bytes_metric_.Add(bytes);
+}
+
+void MulticastPublisher::SendFailed(const std::string& ip, const std::string& error) {
+    ++stats_.errors;
+    errors_metric_.Add();
+    LOG_RATE_LIMITED(LOG_WARN, kSendErrorLogsPerSecond)
+        << "Publish on " << ip << " failed: " << error << ENDLINE;
+}
+
+PublisherStats MulticastPublisher::Stats() const {
+    return stats_;
+}
+
+void MulticastPublisher::ResetStats() {
+    stats_ = PublisherStats();
+    stats_start_ns_ = 0;
+}
+
+std::string MulticastPublisher::FormatStats(const PublisherStats& stats) {
+    std::ostringstream out;
+    out << stats.packets << " packets, " << stats.PacketsPerSecond() << " pps, "
+        << stats.BytesPerSecond() << " bytes/s, " << stats.send_calls << " send calls";
+    if (stats.errors > 0) {
+        out << ", " << stats.errors << " errors";
+    }
+    return out.str();
+}
+
+void TestMulticastPublisher() {
+    MulticastPublisherOptions options;
+    options.loopback = true;
+    options.segmentation = true;
+    MulticastPublisher publisher("239.0.0.100", 6667, options);
+    if (publisher.OpenAllInterfaces() == 0) {
+        LOG_WARN << "No interface to publish on" << ENDLINE;
+        return;
+    }
+
+    const std::vector<uint8_t> payload(1024, 0xAB);
+    const std::vector<boost::asio::const_buffer> packets(256,
+        boost::asio::const_buffer(payload.data(), payload.size()));
+    for (int i = 0; i < 100; ++i) {
+        publisher.Send(packets);
+    }
+    LOG_INFO << "Published " << MulticastPublisher::FormatStats(publisher.Stats()) << ENDLINE;
+}
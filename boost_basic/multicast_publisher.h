@@ -0,0 +1,125 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "ip_address_pool.h"
+#include "metrics.h"
+
+struct MulticastPublisherOptions {
+    MulticastPublisherOptions()
+        : ttl(1), loopback(false), batching(true), segmentation(false), txtime(false) {}
+
+    // IP_MULTICAST_TTL, 1 keeps the packets on the local subnet.
+    int ttl;
+    // IP_MULTICAST_LOOP, lets receivers on this host see the packets.
+    bool loopback;
+    // Sends up to kMaxBatch messages per sendmmsg() call, Linux only.
+    bool batching;
+    // Packs runs of equally sized packets into one UDP_SEGMENT (GSO)
+    // message which the kernel or the nic splits. Needs batching and Linux
+    // 4.18, turned off on the first send the kernel refuses.
+    bool segmentation;
+    // SO_TXTIME, the departure times given to Send() are handed to the
+    // kernel, whose fq qdisc holds each packet until its time. Needs batching
+    // and Linux 4.19, and fq on the interface ("tc qdisc replace dev eth0
+    // root fq"), other qdiscs send at once.
+    bool txtime;
+};
+
+// Packets and bytes sent since the stats were reset.
+struct PublisherStats {
+    PublisherStats() : packets(0), bytes(0), send_calls(0), errors(0), nanoseconds(0) {}
+
+    double PacketsPerSecond() const {
+        return nanoseconds == 0 ? 0 : packets * 1e9 / static_cast<double>(nanoseconds);
+    }
+    double BytesPerSecond() const {
+        return nanoseconds == 0 ? 0 : bytes * 1e9 / static_cast<double>(nanoseconds);
+    }
+
+    uint64_t packets;
+    uint64_t bytes;
+    // System calls, one per batch with batching.
+    uint64_t send_calls;
+    uint64_t errors;
+    uint64_t nanoseconds;
+};
+
+// Sends to a multicast group through every local interface, the sender
+// side of IpDetector for test rigs and replay tools. Each interface has a
+// socket with IP_MULTICAST_IF set to it. Not thread safe.
+class MulticastPublisher {
+public:
+    static constexpr size_t kMaxBatch = 64;
+    // UDP_MAX_SEGMENTS of the kernel.
+    static constexpr size_t kMaxSegments = 64;
+
+    MulticastPublisher(const std::string& multicast_ip, uint16_t multicast_port,
+                       const MulticastPublisherOptions& options = MulticastPublisherOptions());
+    ~MulticastPublisher();
+
+    // Opens a socket on every interface of the IpAddressPool which can send
+    // multicast, returns the number opened.
+    size_t OpenAllInterfaces();
+    bool OpenInterface(const std::string& local_ip);
+    size_t SocketCount() const { return sockets_.size(); }
+    // True if every socket accepted SO_TXTIME.
+    bool TxTimeEnabled() const;
+    void Close();
+
+    // Sends the |count| packets through every interface in order, returns
+    // the number of packets the last interface sent. Blocks while the send
+    // buffer is full.
+    size_t Send(const boost::asio::const_buffer* packets, size_t count);
+    size_t Send(const std::vector<boost::asio::const_buffer>& packets) {
+        return Send(packets.data(), packets.size());
+    }
+    // Packet i leaves at |departure_ns|[i] on the TscClock, which is
+    // CLOCK_MONOTONIC, where TxTimeEnabled(). Such packets aren't segmented.
+    // Elsewhere they leave at once and the caller has to pace them.
+    size_t Send(const boost::asio::const_buffer* packets, const uint64_t* departure_ns,
+                size_t count);
+
+    // |nanoseconds| runs from the first send after the reset, or since
+    // construction, to the end of the last send.
+    PublisherStats Stats() const;
+    void ResetStats();
+    // e.g. "12000 packets, 1.2e+06 pps, 1.4e+09 bytes/s, 190 send calls".
+    static std::string FormatStats(const PublisherStats& stats);
+
+private:
+    struct Socket;
+
+    size_t SendOn(Socket& socket, const boost::asio::const_buffer* packets,
+                  const uint64_t* departure_ns, size_t count);
+    size_t SendBatches(Socket& socket, const boost::asio::const_buffer* packets,
+                       const uint64_t* departure_ns, size_t count);
+    size_t SendEach(Socket& socket, const boost::asio::const_buffer* packets, size_t count);
+    void Sent(size_t packets, size_t bytes);
+    void SendFailed(const std::string& ip, const std::string& error);
+
+    MulticastPublisher(const MulticastPublisher&) = delete;
+    MulticastPublisher& operator=(const MulticastPublisher&) = delete;
+
+private:
+    // A send error on a saturated link repeats for every batch.
+    static constexpr uint64_t kSendErrorLogsPerSecond = 10;
+
+    boost::asio::io_service io_service_;
+    std::shared_ptr<IpAddressPool> ip_address_pool_;
+    boost::asio::ip::udp::endpoint destination_;
+    MulticastPublisherOptions options_;
+    std::vector<std::unique_ptr<Socket>> sockets_;
+
+    PublisherStats stats_;
+    uint64_t stats_start_ns_;
+    MetricCounter packets_metric_;
+    MetricCounter bytes_metric_;
+    MetricCounter errors_metric_;
+};
+
+void TestMulticastPublisher();
@@ -0,0 +1,48 @@
+#include "multicast_socket.h"
+
+namespace {
+    constexpr int kReceiveBufferSize = 1000 * 1024;
+}
+
+bool OpenMulticastReceiveSocket(boost::asio::ip::udp::socket& socket,
+                                const std::string& multicast_ip,
+                                const std::string& local_ip,
+                                uint16_t port,
+                                const SocketFilterProgram& filter,
+                                std::string* error) {
+    boost::system::error_code ec;
+    const boost::asio::ip::address multicast_address =
+        boost::asio::ip::address::from_string(multicast_ip, ec);
+    socket.open(boost::asio::ip::udp::v4(), ec);
+    if (ec) {
+        *error = "Open socket failed! " + ec.message();
+        return false;
+    }
+
+    socket.set_option(boost::asio::ip::udp::socket::reuse_address(true), ec);
+    const boost::asio::ip::address local_address =
+        boost::asio::ip::address::from_string(local_ip, ec);
+    socket.set_option(boost::asio::ip::multicast::join_group(
+        multicast_address.to_v4(), local_address.to_v4()), ec);
+    if (ec) {
+        *error = local_ip + " join group failed! " + ec.message();
+        return false;
+    }
+    socket.set_option(boost::asio::socket_base::receive_buffer_size(kReceiveBufferSize), ec);
+    // Before binding, so no packet is queued unfiltered.
+    if (!filter.empty() && !AttachSocketFilter(socket, filter, error)) {
+        return false;
+    }
+
+    // 1. If bind local address here, linux platform can't receive multicast data.
+    // 2. If bind 0.0.0.0, linux can receive and send, but windows only can receive.
+    // 3. If bind multicast address, linux is OK, but windows unsupported.
+    boost::asio::ip::udp::endpoint listen_endpoint(
+        boost::asio::ip::address::from_string("0.0.0.0"), port);
+    socket.bind(listen_endpoint, ec);
+    if (ec) {
+        *error = "Socket bind error: " + ec.message();
+        return false;
+    }
+    return true;
+}
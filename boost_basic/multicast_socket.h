@@ -0,0 +1,19 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <stdint.h>
+#include <string>
+
+#include "socket_filter.h"
+
+// Opens |socket| to receive |multicast_ip|:|port| through the local
+// interface |local_ip|: joins the group on that interface, enlarges the
+// receive buffer, attaches |filter| unless it is empty and binds the port.
+// Returns false on failure and describes the failing step in |error|, the
+// caller decides whether to log it.
+bool OpenMulticastReceiveSocket(boost::asio::ip::udp::socket& socket,
+                                const std::string& multicast_ip,
+                                const std::string& local_ip,
+                                uint16_t port,
+                                const SocketFilterProgram& filter,
+                                std::string* error);
@@ -0,0 +1,160 @@
+#include "paced_publisher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#include "logger.h"
+#include "tsc_clock.h"
+
+namespace {
+    // A packet sent this much after its departure time counts as late.
+    constexpr uint64_t kLateNanoseconds = 10000;
+
+    inline void CpuRelax() {
+#if defined(LOGGER_HAS_TSC)
+        _mm_pause();
+#endif
+    }
+
+    uint64_t NowNanoseconds() {
+        return logger::TscClock::Instance().NowNanoseconds();
+    }
+}
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : rate_(rate), burst_(burst), tokens_(burst), last_ns_(0) {
+}
+
+uint64_t TokenBucket::Reserve(double tokens, uint64_t now_ns) {
+    if (now_ns > last_ns_) {
+        tokens_ = std::min(burst_, tokens_ + static_cast<double>(now_ns - last_ns_) * rate_ / 1e9);
+        last_ns_ = now_ns;
+    }
+    if (tokens_ >= tokens) {
+        tokens_ -= tokens;
+        return last_ns_;
+    }
+    // In debt, the tokens are available once the deficit has refilled.
+    last_ns_ += static_cast<uint64_t>(std::ceil((tokens - tokens_) * 1e9 / rate_));
+    tokens_ = 0;
+    return last_ns_;
+}
+
+uint64_t HybridTimer::SleepUntil(uint64_t deadline_ns) const {
+    uint64_t now = NowNanoseconds();
+    if (deadline_ns > now + spin_ns_) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(deadline_ns - now - spin_ns_));
+        now = NowNanoseconds();
+    }
+    while (now < deadline_ns) {
+        CpuRelax();
+        now = NowNanoseconds();
+    }
+    return now - deadline_ns;
+}
+
+PacedPublisher::PacedPublisher(MulticastPublisher& publisher, const PacingOptions& options)
+    : publisher_(publisher),
+    options_(options),
+    bucket_(options.rate, options.burst),
+    timer_(options.spin_ns),
+    txtime_(publisher.TxTimeEnabled()),
+    valid_(options.rate > 0 && options.burst >= 0) {
+    // Also rejects a NaN rate or burst.
+    if (!valid_) {
+        LOG_ERROR << "Pacing rate " << options_.rate << " or burst " << options_.burst
+            << " is invalid, nothing will be sent" << ENDLINE;
+        return;
+    }
+    if (txtime_) {
+        LOG_INFO << "Pacing with SO_TXTIME, " << options_.txtime_lead_ns << " ns ahead" << ENDLINE;
+    }
+}
+
+size_t PacedPublisher::Send(const boost::asio::const_buffer* packets, size_t count) {
+    if (!valid_) {
+        return 0;
+    }
+    departures_.resize(count);
+    const uint64_t now = NowNanoseconds();
+    for (size_t i = 0; i < count; ++i) {
+        const double tokens =
+            options_.count_bytes ? static_cast<double>(boost::asio::buffer_size(packets[i])) : 1;
+        departures_[i] = bucket_.Reserve(tokens, now);
+    }
+    return SendScheduled(packets, count);
+}
+
+size_t PacedPublisher::Replay(const boost::asio::const_buffer* packets,
+                              const uint64_t* timestamps_ns, size_t count, double speed) {
+    // Also rejects NaN.
+    if (!(speed > 0)) {
+        LOG_ERROR << "Replay speed " << speed << " isn't positive" << ENDLINE;
+        return 0;
+    }
+    departures_.resize(count);
+    const uint64_t start = NowNanoseconds();
+    for (size_t i = 0; i < count; ++i) {
+        departures_[i] = start + static_cast<uint64_t>(
+            static_cast<double>(timestamps_ns[i] - timestamps_ns[0]) / speed);
+    }
+    return SendScheduled(packets, count);
+}
+
+size_t PacedPublisher::SendScheduled(const boost::asio::const_buffer* packets, size_t count) {
+    const uint64_t lead_ns = txtime_ ? options_.txtime_lead_ns : 0;
+    size_t sent = 0;
+    while (sent < count) {
+        timer_.SleepUntil(departures_[sent] > lead_ns ? departures_[sent] - lead_ns : 0);
+
+        // Whatever is due by now leaves in one batch, a burst of the bucket
+        // or, with SO_TXTIME, the packets of the lead time.
+        const uint64_t now = NowNanoseconds();
+        size_t batch = 1;
+        while (sent + batch < count && batch < MulticastPublisher::kMaxBatch &&
+               departures_[sent + batch] <= now + lead_ns) {
+            ++batch;
+        }
+        if (!txtime_) {
+            for (size_t i = sent; i < sent + batch; ++i) {
+                const uint64_t late_ns = now > departures_[i] ? now - departures_[i] : 0;
+                stats_.late_packets += late_ns > kLateNanoseconds ? 1 : 0;
+                stats_.max_late_ns = std::max(stats_.max_late_ns, late_ns);
+            }
+        }
+
+        const size_t batch_sent = publisher_.Send(packets + sent,
+            txtime_ ? &departures_[sent] : nullptr, batch);
+        stats_.packets += batch_sent;
+        sent += batch_sent;
+        if (batch_sent < batch) {
+            break;
+        }
+    }
+    return sent;
+}
+
+void TestPacedPublisher() {
+    MulticastPublisherOptions publisher_options;
+    publisher_options.loopback = true;
+    MulticastPublisher publisher("239.0.0.100", 6667, publisher_options);
+    if (publisher.OpenAllInterfaces() == 0) {
+        LOG_WARN << "No interface to publish on" << ENDLINE;
+        return;
+    }
+
+    PacingOptions options;
+    options.rate = 20000;
+    options.burst = 4;
+    PacedPublisher paced_publisher(publisher, options);
+    const std::vector<uint8_t> payload(512, 0xAB);
+    const std::vector<boost::asio::const_buffer> packets(2000,
+        boost::asio::const_buffer(payload.data(), payload.size()));
+    paced_publisher.Send(packets.data(), packets.size());
+
+    const PacingStats& stats = paced_publisher.Stats();
+    LOG_INFO << "Paced " << MulticastPublisher::FormatStats(publisher.Stats()) << ", "
+        << stats.late_packets << " late, at most " << stats.max_late_ns << " ns" << ENDLINE;
+}
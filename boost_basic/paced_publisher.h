@@ -0,0 +1,105 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <stdint.h>
+#include <vector>
+
+#include "multicast_publisher.h"
+
+// Tokens refill at |rate| per second up to |burst|. Reserving returns the
+// departure time of the tokens, which is in the future while the bucket is
+// empty, so a whole batch can be scheduled ahead.
+class TokenBucket {
+public:
+    TokenBucket(double rate, double burst);
+
+    // Takes |tokens| and returns when they are available, |now_ns| if they
+    // are. A reservation larger than the burst waits for the difference.
+    uint64_t Reserve(double tokens, uint64_t now_ns);
+
+private:
+    double rate_;
+    double burst_;
+    double tokens_;
+    // The time |tokens_| were counted at, ahead of now while in debt.
+    uint64_t last_ns_;
+};
+
+// Waits for a TscClock deadline: sleeps until |spin_ns| before it, since
+// the OS oversleeps, then spins. The spin window should cover the
+// scheduler's wakeup latency, tens of microseconds on Linux and up to the
+// timer resolution, 1 to 15 ms, on Windows.
+class HybridTimer {
+public:
+    explicit HybridTimer(uint64_t spin_ns) : spin_ns_(spin_ns) {}
+
+    // Returns how late the deadline was reached.
+    uint64_t SleepUntil(uint64_t deadline_ns) const;
+
+private:
+    uint64_t spin_ns_;
+};
+
+struct PacingOptions {
+    PacingOptions()
+        : rate(10000), burst(1), count_bytes(false), spin_ns(100000), txtime_lead_ns(2000000) {}
+
+    // Tokens per second, packets or with |count_bytes| payload bytes. Has to
+    // be positive.
+    double rate;
+    // Tokens which may leave back to back, one sendmmsg() batch. Can't be
+    // negative.
+    double burst;
+    bool count_bytes;
+    uint64_t spin_ns;
+    // Where the publisher has SO_TXTIME, packets are handed to the kernel up
+    // to this long before their departure and the fq qdisc releases them.
+    uint64_t txtime_lead_ns;
+};
+
+struct PacingStats {
+    PacingStats() : packets(0), late_packets(0), max_late_ns(0) {}
+
+    uint64_t packets;
+    // Sent more than 10 microseconds after their departure time, not
+    // counted where the kernel paces with SO_TXTIME.
+    uint64_t late_packets;
+    uint64_t max_late_ns;
+};
+
+// Paces a MulticastPublisher so receivers' socket buffers and the switch
+// queues see a smooth stream instead of bursts. Computes the departure time
+// of every packet, then either sleeps until each is due or, with SO_TXTIME,
+// hands them to the kernel ahead of time. Not thread safe.
+class PacedPublisher {
+public:
+    PacedPublisher(MulticastPublisher& publisher, const PacingOptions& options);
+
+    // Sends the packets at the token bucket rate, returns once the last one
+    // has been sent.
+    size_t Send(const boost::asio::const_buffer* packets, size_t count);
+    // Sends the packets at the rate they were captured at: packet i departs
+    // (|timestamps_ns|[i] - |timestamps_ns|[0]) / |speed| after the call.
+    // The timestamps may be on any clock, but must not decrease. Sends
+    // nothing unless |speed| is positive.
+    size_t Replay(const boost::asio::const_buffer* packets, const uint64_t* timestamps_ns,
+                  size_t count, double speed = 1.0);
+
+    const PacingStats& Stats() const { return stats_; }
+
+private:
+    size_t SendScheduled(const boost::asio::const_buffer* packets, size_t count);
+
+    MulticastPublisher& publisher_;
+    PacingOptions options_;
+    TokenBucket bucket_;
+    HybridTimer timer_;
+    bool txtime_;
+    // False if the options can't be paced, Send() then sends nothing.
+    bool valid_;
+    // Of the packets being sent, kept to not allocate per call.
+    std::vector<uint64_t> departures_;
+    PacingStats stats_;
+};
+
+void TestPacedPublisher();
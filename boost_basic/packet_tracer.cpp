@@ -0,0 +1,114 @@
+#include "packet_tracer.h"
+
+#include <algorithm>
+#include <fstream>
+
+#if defined(__linux__)
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#endif
+
+#include "tsc_clock.h"
+
+namespace {
+    const char* kSpanNames[] = { "kernel to handler", "handler", "callback" };
+
+    void WriteSpan(std::ofstream& out, bool& first, const char* name, uint64_t begin_ns,
+                   uint64_t end_ns, const PacketTrace& trace, size_t thread_id) {
+        if (begin_ns == 0 || end_ns < begin_ns) {
+            return;
+        }
+        // Chrome trace timestamps are microseconds.
+        out << (first ? "" : ",\n") << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1"
+            << ",\"tid\":" << thread_id << ",\"ts\":" << begin_ns / 1000 << "."
+            << begin_ns % 1000 / 100 << begin_ns % 100 / 10 << begin_ns % 10
+            << ",\"dur\":" << static_cast<double>(end_ns - begin_ns) / 1000.0
+            << ",\"args\":{\"packet\":" << trace.sequence << ",\"interface\":\""
+            << trace.interface_ip << "\"}}";
+        first = false;
+    }
+}
+
+PacketTracer::PacketTracer(uint32_t sample_every, size_t capacity)
+    : sample_every_(std::max<uint32_t>(sample_every, 1)),
+    capacity_(std::max<size_t>(capacity, 1)),
+    packet_count_(0),
+    next_trace_(0) {
+}
+
+void PacketTracer::Record(const PacketTrace& trace) {
+    std::lock_guard<std::mutex> lock(traces_mutex_);
+    if (traces_.size() < capacity_) {
+        traces_.push_back(trace);
+        return;
+    }
+    traces_[next_trace_] = trace;
+    next_trace_ = (next_trace_ + 1) % capacity_;
+}
+
+std::vector<PacketTrace> PacketTracer::Traces() const {
+    std::lock_guard<std::mutex> lock(traces_mutex_);
+    std::vector<PacketTrace> traces(traces_.begin() + next_trace_, traces_.end());
+    traces.insert(traces.end(), traces_.begin(), traces_.begin() + next_trace_);
+    return traces;
+}
+
+bool PacketTracer::WriteChromeTrace(const std::string& path) const {
+    std::ofstream out(path.c_str());
+    if (!out) {
+        return false;
+    }
+    const std::vector<PacketTrace> traces = Traces();
+    std::vector<std::string> interfaces;
+    bool first = true;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    for (auto iter = traces.begin(); iter != traces.end(); ++iter) {
+        // One track per interface.
+        auto interface = std::find(interfaces.begin(), interfaces.end(), iter->interface_ip);
+        const size_t thread_id = interface - interfaces.begin() + 1;
+        if (interface == interfaces.end()) {
+            interfaces.push_back(iter->interface_ip);
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1"
+                << ",\"tid\":" << thread_id << ",\"args\":{\"name\":\"" << iter->interface_ip
+                << "\"}}";
+            first = false;
+        }
+        const uint64_t* stage_ns = iter->stage_ns;
+        WriteSpan(out, first, kSpanNames[0], stage_ns[kStageKernelRx],
+            stage_ns[kStageHandlerEntry], *iter, thread_id);
+        WriteSpan(out, first, kSpanNames[1], stage_ns[kStageHandlerEntry],
+            stage_ns[kStageCallbackStart], *iter, thread_id);
+        WriteSpan(out, first, kSpanNames[2], stage_ns[kStageCallbackStart],
+            stage_ns[kStageCallbackReturn], *iter, thread_id);
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+uint64_t PacketTracer::NowNanoseconds() {
+    return logger::TscClock::Instance().NowRealtimeNanoseconds();
+}
+
+void PacketTracer::EnableKernelTimestamps(boost::asio::ip::udp::socket& socket) {
+#if defined(__linux__) && defined(SO_TIMESTAMPNS)
+    const int enable = 1;
+    setsockopt(socket.native_handle(), SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
+#else
+    (void)socket;
+#endif
+}
+
+uint64_t PacketTracer::KernelRxNanoseconds(boost::asio::ip::udp::socket& socket) {
+#if defined(__linux__) && defined(SIOCGSTAMPNS)
+    struct timespec stamp;
+    if (ioctl(socket.native_handle(), SIOCGSTAMPNS, &stamp) == 0) {
+        return static_cast<uint64_t>(stamp.tv_sec) * 1000000000 +
+            static_cast<uint64_t>(stamp.tv_nsec);
+    }
+#else
+    (void)socket;
+#endif
+    return 0;
+}
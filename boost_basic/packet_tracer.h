@@ -0,0 +1,62 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Stages of a received packet, all timestamps are wall clock nanoseconds.
+enum PacketStage {
+    // Arrival in the kernel, zero where the platform can't report it.
+    kStageKernelRx,
+    // The receive handler is dequeued and entered by the io_service.
+    kStageHandlerEntry,
+    kStageCallbackStart,
+    kStageCallbackReturn,
+    kStageCount
+};
+
+struct PacketTrace {
+    PacketTrace() : sequence(0), stage_ns() {}
+
+    uint64_t sequence;
+    std::string interface_ip;
+    uint64_t stage_ns[kStageCount];
+};
+
+// Keeps the stage timestamps of one packet in every |sample_every| and
+// writes them in the Chrome trace event format, which chrome://tracing and
+// Perfetto open. A packet which isn't sampled costs one increment.
+class PacketTracer {
+public:
+    explicit PacketTracer(uint32_t sample_every, size_t capacity = 4096);
+
+    // Called once per packet from the receiving thread, true if this packet
+    // is traced.
+    bool Sample() {
+        return ++packet_count_ % sample_every_ == 0;
+    }
+
+    uint64_t PacketCount() const { return packet_count_; }
+
+    // Keeps the last |capacity| traces.
+    void Record(const PacketTrace& trace);
+    std::vector<PacketTrace> Traces() const;
+    bool WriteChromeTrace(const std::string& path) const;
+
+    static uint64_t NowNanoseconds();
+    // Asks the kernel when the last packet of |socket| arrived, the socket
+    // needs EnableKernelTimestamps(). Returns zero if unsupported.
+    static uint64_t KernelRxNanoseconds(boost::asio::ip::udp::socket& socket);
+    static void EnableKernelTimestamps(boost::asio::ip::udp::socket& socket);
+
+private:
+    uint32_t sample_every_;
+    size_t capacity_;
+    uint64_t packet_count_;
+
+    mutable std::mutex traces_mutex_;
+    std::vector<PacketTrace> traces_;
+    size_t next_trace_;
+};
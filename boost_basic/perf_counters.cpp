@@ -0,0 +1,142 @@
+#include "perf_counters.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    const char* kPerfEventNames[kPerfEventCount] = {
+        "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses",
+        "context_switches"
+    };
+
+#if defined(__linux__)
+    struct PerfEventConfig {
+        uint32_t type;
+        uint64_t config;
+    };
+
+    const PerfEventConfig kPerfEventConfigs[kPerfEventCount] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    };
+
+    int OpenPerfEvent(const PerfEventConfig& config, int group_fd, bool exclude_kernel) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = config.type;
+        attr.config = config.config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = exclude_kernel ? 1 : 0;
+        attr.exclude_hv = 1;
+        // The group starts disabled and is enabled as a whole.
+        attr.disabled = group_fd < 0 ? 1 : 0;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+    }
+#endif
+}
+
+const char* PerfEventName(PerfEvent event) {
+    return kPerfEventNames[event];
+}
+
+PerfCounterGroup::PerfCounterGroup() : leader_fd_(-1), opened_count_(0) {
+    for (int i = 0; i < kPerfEventCount; ++i) {
+        fds_[i] = -1;
+        indices_[i] = -1;
+    }
+#if defined(__linux__)
+    // Counting the kernel side shows the syscall cost, but needs a lower
+    // perf_event_paranoid, so fall back to user space only.
+    bool exclude_kernel = false;
+    for (int i = 0; i < kPerfEventCount; ++i) {
+        // Events the cpu doesn't have, or a virtual machine without a PMU,
+        // are left out of the group. The first event opened leads it.
+        fds_[i] = OpenPerfEvent(kPerfEventConfigs[i], leader_fd_, exclude_kernel);
+        if (fds_[i] < 0 && leader_fd_ < 0 && !exclude_kernel) {
+            exclude_kernel = true;
+            fds_[i] = OpenPerfEvent(kPerfEventConfigs[i], leader_fd_, exclude_kernel);
+            if (fds_[i] < 0) {
+                exclude_kernel = false;
+            }
+        }
+        if (fds_[i] >= 0) {
+            if (leader_fd_ < 0) {
+                leader_fd_ = fds_[i];
+            }
+            indices_[i] = opened_count_++;
+        }
+    }
+    if (leader_fd_ < 0) {
+        return;
+    }
+    ioctl(leader_fd_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader_fd_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+PerfCounterGroup::~PerfCounterGroup() {
+#if defined(__linux__)
+    for (int i = kPerfEventCount - 1; i >= 0; --i) {
+        if (fds_[i] >= 0) {
+            close(fds_[i]);
+        }
+    }
+#endif
+}
+
+PerfSample PerfCounterGroup::Read() const {
+    PerfSample sample;
+#if defined(__linux__)
+    if (leader_fd_ < 0) {
+        return sample;
+    }
+    // PERF_FORMAT_GROUP: the number of events, then their values.
+    uint64_t buffer[1 + kPerfEventCount];
+    const ssize_t size = read(leader_fd_, buffer, sizeof(buffer));
+    if (size < static_cast<ssize_t>(sizeof(uint64_t) * (1 + opened_count_))) {
+        return sample;
+    }
+    for (int i = 0; i < kPerfEventCount; ++i) {
+        if (indices_[i] >= 0) {
+            sample.values[i] = buffer[1 + indices_[i]];
+        }
+    }
+#endif
+    return sample;
+}
+
+PerfMetrics PerfMetrics::Create(const std::string& region) {
+    MetricsRegistry& registry = MetricsRegistry::Instance();
+    const std::string label = "{region=\"" + region + "\"}";
+    PerfMetrics metrics;
+    metrics.scopes = registry.AddCounter("perf_scopes_total" + label,
+        "Profiled executions of the region");
+    for (int i = 0; i < kPerfEventCount; ++i) {
+        metrics.events[i] = registry.AddCounter(
+            std::string("perf_") + kPerfEventNames[i] + "_total" + label,
+            std::string("Perf event ") + kPerfEventNames[i] + " counted in the region");
+    }
+    return metrics;
+}
+
+PerfScope::~PerfScope() {
+    if (!group_) {
+        return;
+    }
+    const PerfSample end = group_->Read();
+    metrics_.scopes.Add();
+    for (int i = 0; i < kPerfEventCount; ++i) {
+        metrics_.events[i].Add(end.values[i] - start_.values[i]);
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "metrics.h"
+
+// Hardware and software performance counters of the calling thread, read
+// with perf_event_open on Linux. Elsewhere, or when the kernel refuses
+// (see /proc/sys/kernel/perf_event_paranoid), the group is unavailable and
+// every read returns zeros.
+enum PerfEvent {
+    kPerfCycles,
+    kPerfInstructions,
+    kPerfL1dMisses,
+    kPerfLlcMisses,
+    kPerfBranchMisses,
+    kPerfContextSwitches,
+    kPerfEventCount
+};
+
+const char* PerfEventName(PerfEvent event);
+
+struct PerfSample {
+    PerfSample() : values() {}
+    uint64_t values[kPerfEventCount];
+};
+
+class PerfCounterGroup {
+public:
+    // Counts the calling thread only, so it has to be created on the thread
+    // which runs the measured code.
+    PerfCounterGroup();
+    ~PerfCounterGroup();
+
+    bool Available() const { return leader_fd_ >= 0; }
+    bool EventAvailable(PerfEvent event) const { return indices_[event] >= 0; }
+
+    // One read of the whole group.
+    PerfSample Read() const;
+
+private:
+    PerfCounterGroup(const PerfCounterGroup&) = delete;
+    PerfCounterGroup& operator=(const PerfCounterGroup&) = delete;
+
+    int leader_fd_;
+    int fds_[kPerfEventCount];
+    // Position of the event in the group read, -1 if it couldn't be opened.
+    int indices_[kPerfEventCount];
+    int opened_count_;
+};
+
+// Counters of a profiled region in the MetricsRegistry, named
+// perf_<event>_total{region="<region>"}.
+struct PerfMetrics {
+    static PerfMetrics Create(const std::string& region);
+
+    MetricCounter scopes;
+    MetricCounter events[kPerfEventCount];
+};
+
+// Adds what the counters of |group| advanced during its lifetime to
+// |metrics|. A null group makes it a no-op.
+class PerfScope {
+public:
+    PerfScope(const PerfCounterGroup* group, const PerfMetrics& metrics)
+        : group_(group && group->Available() ? group : nullptr), metrics_(metrics) {
+        if (group_) {
+            start_ = group_->Read();
+        }
+    }
+
+    ~PerfScope();
+
+private:
+    const PerfCounterGroup* group_;
+    const PerfMetrics& metrics_;
+    PerfSample start_;
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "handler_memory.h"
+#include "tsc_clock.h"
+
+// Receives on a set of UDP sockets and hands every packet to |Callback|,
+// called as callback(interface_ip, data, size) and returning whether to
+// receive on that socket again. The callback is a template parameter, so a
+// lambda is called directly and can be inlined, where IpDetectCallback
+// costs an indirect call per packet. Receive operations come from a
+// HandlerMemory per socket, so a running engine doesn't allocate.
+// Sockets are added before Start(), all of them on one io_service, and a
+// started engine mustn't move.
+template <typename Callback>
+class ReceiveEngine {
+public:
+    static constexpr size_t kBufferSize = 1500;
+
+    explicit ReceiveEngine(Callback callback)
+        : callback_(std::move(callback)), error_count_(0) {
+    }
+
+    // Takes over |socket|, which is open and bound already, e.g. by
+    // OpenMulticastReceiveSocket().
+    void AddSocket(const std::string& interface_ip, boost::asio::ip::udp::socket socket) {
+        endpoints_.emplace_back(new Endpoint(interface_ip, std::move(socket)));
+    }
+
+    void Start() {
+        for (auto iter = endpoints_.begin(); iter != endpoints_.end(); ++iter) {
+            DoReceive(**iter);
+        }
+    }
+
+    // Cancels the outstanding receives, the sockets are kept.
+    void Close() {
+        boost::system::error_code ec;
+        for (auto iter = endpoints_.begin(); iter != endpoints_.end(); ++iter) {
+            (*iter)->socket.close(ec);
+        }
+    }
+
+    size_t SocketCount() const { return endpoints_.size(); }
+    // Receives which failed, their socket stops receiving.
+    uint64_t ErrorCount() const { return error_count_; }
+
+private:
+    struct Endpoint {
+        Endpoint(const std::string& ip, boost::asio::ip::udp::socket&& socket)
+            : interface_ip(ip), socket(std::move(socket)) {
+        }
+
+        std::string interface_ip;
+        boost::asio::ip::udp::socket socket;
+        boost::asio::ip::udp::endpoint sender;
+        HandlerMemory handler_memory;
+        uint8_t buffer[kBufferSize];
+    };
+
+    void DoReceive(Endpoint& endpoint) {
+        endpoint.socket.async_receive_from(
+            boost::asio::buffer(endpoint.buffer, kBufferSize), endpoint.sender,
+            MakeCustomAllocHandler(endpoint.handler_memory,
+                [this, &endpoint](const boost::system::error_code& error,
+                                  std::size_t bytes_transferred) {
+                    if (error) {
+                        if (error != boost::asio::error::operation_aborted) {
+                            ++error_count_;
+                        }
+                        return;
+                    }
+                    if (callback_(endpoint.interface_ip, endpoint.buffer, bytes_transferred)) {
+                        DoReceive(endpoint);
+                    }
+                }));
+    }
+
+private:
+    Callback callback_;
+    std::vector<std::unique_ptr<Endpoint>> endpoints_;
+    uint64_t error_count_;
+};
+
+template <typename Callback>
+constexpr size_t ReceiveEngine<Callback>::kBufferSize;
+
+// Deduces the callback type, e.g. for a lambda.
+template <typename Callback>
+ReceiveEngine<typename std::decay<Callback>::type> MakeReceiveEngine(Callback&& callback) {
+    return ReceiveEngine<typename std::decay<Callback>::type>(
+        std::forward<Callback>(callback));
+}
+
+// One packet of a batch. |data| stays valid until the batch callback
+// returns.
+struct PacketDescriptor {
+    const uint8_t* data;
+    uint32_t length;
+    // The order the socket was added to the BatchReceiveEngine.
+    uint16_t interface_index;
+    uint16_t sender_port;
+    // Host byte order, zero for a non IPv4 sender.
+    uint32_t sender_ip;
+    // Wall clock nanoseconds when the packet was read.
+    uint64_t timestamp_ns;
+};
+
+// Receives like ReceiveEngine, but on every wakeup of a socket reads all
+// the packets waiting on it, up to kMaxBatch, and hands them to |Callback|
+// at once, called as callback(const PacketDescriptor* packets, size_t count)
+// and returning whether to receive on that socket again. Lets a consumer
+// amortise its work over the batch, e.g. prefetch or push to a queue once.
+template <typename Callback>
+class BatchReceiveEngine {
+public:
+    static constexpr size_t kBufferSize = 1500;
+    static constexpr size_t kMaxBatch = 64;
+
+    explicit BatchReceiveEngine(Callback callback)
+        : callback_(std::move(callback)), error_count_(0) {
+        // Drain() stamps every packet.
+        logger::TscClock::WarmUp();
+    }
+
+    // Takes over |socket|, which is open and bound already, and returns the
+    // interface index of its packets.
+    uint16_t AddSocket(const std::string& interface_ip, boost::asio::ip::udp::socket socket) {
+        const uint16_t index = static_cast<uint16_t>(endpoints_.size());
+        endpoints_.emplace_back(new Endpoint(interface_ip, index, std::move(socket)));
+        boost::system::error_code ec;
+        endpoints_.back()->socket.non_blocking(true, ec);
+        return index;
+    }
+
+    const std::string& InterfaceIp(uint16_t interface_index) const {
+        return endpoints_[interface_index]->interface_ip;
+    }
+
+    void Start() {
+        for (auto iter = endpoints_.begin(); iter != endpoints_.end(); ++iter) {
+            DoWait(**iter);
+        }
+    }
+
+    void Close() {
+        boost::system::error_code ec;
+        for (auto iter = endpoints_.begin(); iter != endpoints_.end(); ++iter) {
+            (*iter)->socket.close(ec);
+        }
+    }
+
+    size_t SocketCount() const { return endpoints_.size(); }
+    uint64_t ErrorCount() const { return error_count_; }
+
+private:
+    struct Endpoint {
+        Endpoint(const std::string& ip, uint16_t index, boost::asio::ip::udp::socket&& socket)
+            : interface_ip(ip), interface_index(index), socket(std::move(socket)) {
+        }
+
+        std::string interface_ip;
+        uint16_t interface_index;
+        boost::asio::ip::udp::socket socket;
+        HandlerMemory handler_memory;
+        PacketDescriptor packets[kMaxBatch];
+        uint8_t buffers[kMaxBatch][kBufferSize];
+    };
+
+    // Waits for the socket to become readable without reading, the packets
+    // are read by Drain().
+    void DoWait(Endpoint& endpoint) {
+        endpoint.socket.async_receive(boost::asio::null_buffers(),
+            MakeCustomAllocHandler(endpoint.handler_memory,
+                [this, &endpoint](const boost::system::error_code& error, std::size_t) {
+                    if (error) {
+                        if (error != boost::asio::error::operation_aborted) {
+                            ++error_count_;
+                        }
+                        return;
+                    }
+                    const size_t count = Drain(endpoint);
+                    if (count == 0 || callback_(endpoint.packets, count)) {
+                        DoWait(endpoint);
+                    }
+                }));
+    }
+
+    size_t Drain(Endpoint& endpoint) {
+        const logger::TscClock& clock = logger::TscClock::Instance();
+        boost::asio::ip::udp::endpoint sender;
+        boost::system::error_code ec;
+        size_t count = 0;
+        while (count < kMaxBatch) {
+            const size_t length = endpoint.socket.receive_from(
+                boost::asio::buffer(endpoint.buffers[count], kBufferSize), sender, 0, ec);
+            if (ec) {
+                if (ec != boost::asio::error::would_block) {
+                    ++error_count_;
+                }
+                break;
+            }
+            PacketDescriptor& packet = endpoint.packets[count];
+            packet.data = endpoint.buffers[count];
+            packet.length = static_cast<uint32_t>(length);
+            packet.interface_index = endpoint.interface_index;
+            packet.sender_port = sender.port();
+            packet.sender_ip = sender.address().is_v4() ?
+                static_cast<uint32_t>(sender.address().to_v4().to_ulong()) : 0;
+            packet.timestamp_ns = clock.NowRealtimeNanoseconds();
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    Callback callback_;
+    std::vector<std::unique_ptr<Endpoint>> endpoints_;
+    uint64_t error_count_;
+};
+
+template <typename Callback>
+constexpr size_t BatchReceiveEngine<Callback>::kBufferSize;
+template <typename Callback>
+constexpr size_t BatchReceiveEngine<Callback>::kMaxBatch;
+
+template <typename Callback>
+BatchReceiveEngine<typename std::decay<Callback>::type> MakeBatchReceiveEngine(
+    Callback&& callback) {
+    return BatchReceiveEngine<typename std::decay<Callback>::type>(
+        std::forward<Callback>(callback));
+}
@@ -0,0 +1,356 @@
+#include "socket_filter.h"
+
+#include <sstream>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <linux/filter.h>
+#include <string.h>
+#include <sys/socket.h>
+#endif
+
+#include "logger.h"
+
+namespace {
+    // The opcodes of linux/filter.h, which Windows doesn't have.
+    constexpr uint16_t kBpfLd = 0x00;
+    constexpr uint16_t kBpfAlu = 0x04;
+    constexpr uint16_t kBpfJmp = 0x05;
+    constexpr uint16_t kBpfRet = 0x06;
+    constexpr uint16_t kBpfW = 0x00;
+    constexpr uint16_t kBpfH = 0x08;
+    constexpr uint16_t kBpfB = 0x10;
+    constexpr uint16_t kBpfAbs = 0x20;
+    constexpr uint16_t kBpfLen = 0x80;
+    constexpr uint16_t kBpfAnd = 0x50;
+    constexpr uint16_t kBpfJa = 0x00;
+    constexpr uint16_t kBpfJeq = 0x10;
+    constexpr uint16_t kBpfJgt = 0x20;
+    constexpr uint16_t kBpfJge = 0x30;
+    constexpr uint16_t kBpfK = 0x00;
+
+    // SKF_NET_OFF, negative offsets load from the network header.
+    constexpr uint32_t kNetworkOffset = static_cast<uint32_t>(-0x100000);
+    constexpr uint32_t kSourceOffset = kNetworkOffset + 12;
+    constexpr uint32_t kDestinationOffset = kNetworkOffset + 16;
+    constexpr uint32_t kPortOffset = 2;
+    constexpr uint32_t kUdpHeaderSize = 8;
+
+    constexpr uint32_t kAcceptPacket = 0xFFFFFFFF;
+    constexpr uint32_t kDropPacket = 0;
+    constexpr size_t kMaxJump = 0xFF;
+
+#if defined(__linux__)
+    static_assert(sizeof(SocketFilterInstruction) == sizeof(struct sock_filter),
+        "SocketFilterInstruction has to be laid out as struct sock_filter");
+#endif
+
+    // Emits the instructions, the jumps target labels which are resolved by
+    // Finish().
+    class ProgramBuilder {
+    public:
+        static constexpr int kReject = 0;
+
+        ProgramBuilder() : label_indexes_(1, 0) {}
+
+        int NewLabel() {
+            label_indexes_.push_back(0);
+            return static_cast<int>(label_indexes_.size() - 1);
+        }
+
+        void Bind(int label) { label_indexes_[label] = program_.size(); }
+
+        void Emit(uint16_t code, uint32_t k) {
+            program_.push_back(SocketFilterInstruction{ code, 0, 0, k });
+        }
+
+        // Continues if the accumulator compares true with |k|, jumps to
+        // |label| otherwise.
+        void JumpUnless(uint16_t jump, uint32_t k, int label) {
+            jumps_.push_back(Jump{ program_.size(), label, false });
+            Emit(kBpfJmp | jump | kBpfK, k);
+        }
+
+        // Jumps to |label| if the accumulator compares true with |k|.
+        void JumpIf(uint16_t jump, uint32_t k, int label) {
+            jumps_.push_back(Jump{ program_.size(), label, true });
+            Emit(kBpfJmp | jump | kBpfK, k);
+        }
+
+        void JumpAlways(int label) {
+            always_jumps_.push_back(Jump{ program_.size(), label, true });
+            Emit(kBpfJmp | kBpfJa, 0);
+        }
+
+        bool Finish(SocketFilterProgram* program) {
+            Emit(kBpfRet | kBpfK, kAcceptPacket);
+            Bind(kReject);
+            Emit(kBpfRet | kBpfK, kDropPacket);
+
+            for (auto iter = jumps_.begin(); iter != jumps_.end(); ++iter) {
+                const size_t distance = label_indexes_[iter->label] - iter->index - 1;
+                if (distance > kMaxJump) {
+                    return false;
+                }
+                SocketFilterInstruction& instruction = program_[iter->index];
+                (iter->taken ? instruction.jt : instruction.jf) = static_cast<uint8_t>(distance);
+            }
+            for (auto iter = always_jumps_.begin(); iter != always_jumps_.end(); ++iter) {
+                program_[iter->index].k =
+                    static_cast<uint32_t>(label_indexes_[iter->label] - iter->index - 1);
+            }
+            program->swap(program_);
+            return true;
+        }
+
+    private:
+        struct Jump {
+            size_t index;
+            int label;
+            // Patches jt, else jf.
+            bool taken;
+        };
+
+        SocketFilterProgram program_;
+        std::vector<size_t> label_indexes_;
+        std::vector<Jump> jumps_;
+        std::vector<Jump> always_jumps_;
+    };
+
+    uint32_t PrefixMask(uint8_t length) {
+        return length == 0 ? 0 : 0xFFFFFFFF << (32 - length);
+    }
+
+    bool ParseAddress(const std::string& text, uint32_t* address) {
+        boost::system::error_code ec;
+        const boost::asio::ip::address_v4 parsed = boost::asio::ip::address_v4::from_string(text, ec);
+        *address = static_cast<uint32_t>(parsed.to_ulong());
+        return !ec;
+    }
+
+    bool ParseNumber(const std::string& text, uint32_t max, uint32_t* number) {
+        if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos ||
+            text.size() > 10) {
+            return false;
+        }
+        const uint64_t value = std::stoull(text);
+        *number = static_cast<uint32_t>(value);
+        return value <= max;
+    }
+
+    bool ParseHexBytes(const std::string& text, std::vector<uint8_t>* bytes) {
+        if (text.empty() || text.size() % 2 != 0 ||
+            text.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+            return false;
+        }
+        bytes->clear();
+        for (size_t i = 0; i < text.size(); i += 2) {
+            bytes->push_back(static_cast<uint8_t>(std::stoul(text.substr(i, 2), nullptr, 16)));
+        }
+        return true;
+    }
+
+    bool ParseClause(const std::string& clause, std::istringstream& in, SocketFilterRules* rules) {
+        std::string argument;
+        if (!(in >> argument)) {
+            return false;
+        }
+        uint32_t number = 0;
+        if (clause == "src") {
+            SocketFilterRules::Prefix prefix{ 0, 32 };
+            const size_t slash = argument.find('/');
+            if (slash != std::string::npos) {
+                if (!ParseNumber(argument.substr(slash + 1), 32, &number)) {
+                    return false;
+                }
+                prefix.length = static_cast<uint8_t>(number);
+            }
+            if (!ParseAddress(argument.substr(0, slash), &prefix.address)) {
+                return false;
+            }
+            rules->sources.push_back(prefix);
+            return true;
+        }
+        if (clause == "dst") {
+            return ParseAddress(argument, &rules->group);
+        }
+        if (clause == "port") {
+            if (!ParseNumber(argument, 0xFFFF, &number)) {
+                return false;
+            }
+            rules->port = static_cast<uint16_t>(number);
+            return true;
+        }
+        if (clause == "len") {
+            const size_t dash = argument.find('-');
+            uint32_t max = 0;
+            if (dash == std::string::npos || !ParseNumber(argument.substr(0, dash), 0xFFFF, &number) ||
+                !ParseNumber(argument.substr(dash + 1), 0xFFFF, &max)) {
+                return false;
+            }
+            rules->min_payload = static_cast<uint16_t>(number);
+            rules->max_payload = static_cast<uint16_t>(max);
+            return true;
+        }
+        if (clause == "byte") {
+            SocketFilterRules::ByteMatch match;
+            std::string bytes;
+            if (!ParseNumber(argument, 0xFFFF, &number) || !(in >> bytes) ||
+                !ParseHexBytes(bytes, &match.bytes)) {
+                return false;
+            }
+            match.offset = static_cast<uint16_t>(number);
+            rules->byte_matches.push_back(match);
+            return true;
+        }
+        return false;
+    }
+
+    // Loads |bytes| at |offset| in the widest pieces and compares each.
+    void EmitByteMatch(ProgramBuilder& builder, uint32_t offset, const std::vector<uint8_t>& bytes) {
+        size_t i = 0;
+        while (i < bytes.size()) {
+            const size_t remaining = bytes.size() - i;
+            const size_t width = remaining >= 4 ? 4 : (remaining >= 2 ? 2 : 1);
+            uint32_t value = 0;
+            for (size_t j = 0; j < width; ++j) {
+                value = (value << 8) | bytes[i + j];
+            }
+            const uint16_t size = width == 4 ? kBpfW : (width == 2 ? kBpfH : kBpfB);
+            builder.Emit(kBpfLd | size | kBpfAbs, offset + static_cast<uint32_t>(i));
+            builder.JumpUnless(kBpfJeq, value, ProgramBuilder::kReject);
+            i += width;
+        }
+    }
+}
+
+bool ParseSocketFilterRules(const std::string& description, SocketFilterRules* rules) {
+    *rules = SocketFilterRules();
+    std::istringstream in(description);
+    std::string clause;
+    while (in >> clause) {
+        if (!ParseClause(clause, in, rules)) {
+            LOG_ERROR << "Bad socket filter clause '" << clause << "' in: " << description << ENDLINE;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CompileSocketFilter(const SocketFilterRules& rules, SocketFilterProgram* program) {
+    if (rules.min_payload > rules.max_payload) {
+        return false;
+    }
+    ProgramBuilder builder;
+
+    bool any_source = rules.sources.empty();
+    for (auto iter = rules.sources.begin(); iter != rules.sources.end(); ++iter) {
+        if (iter->length > 32) {
+            return false;
+        }
+        any_source = any_source || iter->length == 0;
+    }
+    if (!any_source) {
+        const int source_matched = builder.NewLabel();
+        for (auto iter = rules.sources.begin(); iter != rules.sources.end(); ++iter) {
+            const uint32_t mask = PrefixMask(iter->length);
+            builder.Emit(kBpfLd | kBpfW | kBpfAbs, kSourceOffset);
+            if (mask != 0xFFFFFFFF) {
+                builder.Emit(kBpfAlu | kBpfAnd | kBpfK, mask);
+            }
+            builder.JumpIf(kBpfJeq, iter->address & mask, source_matched);
+        }
+        builder.JumpAlways(ProgramBuilder::kReject);
+        builder.Bind(source_matched);
+    }
+
+    if (rules.group != 0) {
+        builder.Emit(kBpfLd | kBpfW | kBpfAbs, kDestinationOffset);
+        builder.JumpUnless(kBpfJeq, rules.group, ProgramBuilder::kReject);
+    }
+    if (rules.port != 0) {
+        builder.Emit(kBpfLd | kBpfH | kBpfAbs, kPortOffset);
+        builder.JumpUnless(kBpfJeq, rules.port, ProgramBuilder::kReject);
+    }
+
+    // The length includes the UDP header.
+    if (rules.min_payload > 0 || rules.max_payload < 0xFFFF) {
+        builder.Emit(kBpfLd | kBpfW | kBpfLen, 0);
+        if (rules.min_payload > 0) {
+            builder.JumpUnless(kBpfJge, rules.min_payload + kUdpHeaderSize, ProgramBuilder::kReject);
+        }
+        if (rules.max_payload < 0xFFFF) {
+            builder.JumpIf(kBpfJgt, rules.max_payload + kUdpHeaderSize, ProgramBuilder::kReject);
+        }
+    }
+
+    // A load past the end of the packet drops it, so a short packet fails.
+    for (auto iter = rules.byte_matches.begin(); iter != rules.byte_matches.end(); ++iter) {
+        if (iter->bytes.empty()) {
+            return false;
+        }
+        EmitByteMatch(builder, kUdpHeaderSize + iter->offset, iter->bytes);
+    }
+    return builder.Finish(program);
+}
+
+bool AttachSocketFilter(boost::asio::ip::udp::socket& socket, const SocketFilterProgram& program,
+                        std::string* error) {
+#if defined(__linux__)
+    struct sock_fprog fprog;
+    fprog.len = static_cast<unsigned short>(program.size());
+    fprog.filter = reinterpret_cast<struct sock_filter*>(
+        const_cast<SocketFilterInstruction*>(program.data()));
+    if (program.empty() || program.size() > BPF_MAXINSNS ||
+        setsockopt(socket.native_handle(), SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) != 0) {
+        *error = std::string("Attach socket filter failed! ") + strerror(errno);
+        return false;
+    }
+    return true;
+#else
+    (void)socket;
+    (void)program;
+    *error = "Socket filters are only supported on linux";
+    return false;
+#endif
+}
+
+void TestSocketFilter() {
+    boost::asio::io_service io_service;
+    boost::asio::ip::udp::socket receiver(io_service, boost::asio::ip::udp::endpoint(
+        boost::asio::ip::address_v4::loopback(), 0));
+    const uint16_t port = receiver.local_endpoint().port();
+
+    SocketFilterRules rules;
+    SocketFilterProgram program;
+    if (!ParseSocketFilterRules("src 127.0.0.0/8 dst 127.0.0.1 port " + std::to_string(port) +
+            " len 4-64 byte 0 cafe", &rules) || !CompileSocketFilter(rules, &program)) {
+        return;
+    }
+    std::string error;
+    if (!AttachSocketFilter(receiver, program, &error)) {
+        LOG_ERROR << error << ENDLINE;
+        return;
+    }
+    LOG_INFO << "Socket filter of " << program.size() << " instructions attached" << ENDLINE;
+
+    // Only the first and the last pass.
+    const std::string packets[] = { std::string("\xca\xfe\x00\x01", 4), std::string("\xca\xfe", 2),
+        std::string("\xbe\xef\x00\x01", 4), std::string(65, '\0'),
+        std::string("\xca\xfe", 2) + std::string(62, 'x') };
+    boost::asio::ip::udp::socket sender(io_service, boost::asio::ip::udp::v4());
+    for (size_t i = 0; i < sizeof(packets) / sizeof(packets[0]); ++i) {
+        sender.send_to(boost::asio::buffer(packets[i]), receiver.local_endpoint());
+    }
+
+    receiver.non_blocking(true);
+    boost::system::error_code ec;
+    char buffer[128];
+    for (;;) {
+        const size_t bytes = receiver.receive(boost::asio::buffer(buffer), 0, ec);
+        if (ec) {
+            break;
+        }
+        LOG_INFO << "Filter passed a packet of " << bytes << " bytes" << ENDLINE;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// What a socket accepts, every rule which is set has to match. Addresses are
+// in host byte order, payload offsets count from the end of the UDP header.
+struct SocketFilterRules {
+    struct Prefix {
+        uint32_t address;
+        uint8_t length;
+    };
+
+    struct ByteMatch {
+        uint16_t offset;
+        std::vector<uint8_t> bytes;
+    };
+
+    SocketFilterRules() : group(0), port(0), min_payload(0), max_payload(0xFFFF) {}
+
+    // The source is in any of |sources|, any source if empty.
+    std::vector<Prefix> sources;
+    // Destination address, zero for any.
+    uint32_t group;
+    // Destination port, zero for any.
+    uint16_t port;
+    uint16_t min_payload;
+    uint16_t max_payload;
+    std::vector<ByteMatch> byte_matches;
+};
+
+// Parses a rule description of whitespace separated clauses:
+//   src 10.1.0.0/16    the source is in the prefix, may be repeated
+//   dst 239.255.0.1    the destination address
+//   port 6667          the destination port
+//   len 64-1472        the payload length range, inclusive
+//   byte 4 0a0b        the payload holds these hex bytes at offset 4
+// Returns false and leaves |rules| unspecified on a malformed description.
+bool ParseSocketFilterRules(const std::string& description, SocketFilterRules* rules);
+
+// One classic BPF instruction, laid out as struct sock_filter.
+struct SocketFilterInstruction {
+    uint16_t code;
+    uint8_t jt;
+    uint8_t jf;
+    uint32_t k;
+};
+
+using SocketFilterProgram = std::vector<SocketFilterInstruction>;
+
+// Compiles |rules| to a classic BPF program which returns the whole packet
+// if it matches and drops it otherwise. The program runs on the UDP header
+// and reaches the ip header through SKF_NET_OFF. Returns false if the rules
+// are invalid or too long for the 8 bit jump offsets.
+bool CompileSocketFilter(const SocketFilterRules& rules, SocketFilterProgram* program);
+
+// Attaches |program| with SO_ATTACH_FILTER, the kernel then drops the
+// packets it rejects before they are queued on |socket|. Attach before
+// binding, packets queued earlier are delivered unfiltered. Returns false
+// if the kernel refuses the program or the platform has no socket filters,
+// which is every platform but Linux, and describes why in |error|. It
+// doesn't log, so the LeanIpDetector can use it.
+bool AttachSocketFilter(boost::asio::ip::udp::socket& socket, const SocketFilterProgram& program,
+                        std::string* error);
+
+void TestSocketFilter();
@@ -0,0 +1,347 @@
+#include "stats_http_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "logger.h"
+
+namespace {
+    constexpr size_t kMaxRequestSize = 8192;
+    constexpr long kRateSampleSeconds = 1;
+
+    // Lowers the priority of the calling thread only.
+    void LowerThreadPriority() {
+#ifdef _WIN32
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#endif
+    }
+
+    // Splits packets_total{interface="eth0"} into the name and the labels
+    // without the braces.
+    void SplitName(const std::string& full_name, std::string& name, std::string& labels) {
+        const size_t brace = full_name.find('{');
+        if (brace == std::string::npos) {
+            name = full_name;
+            labels.clear();
+            return;
+        }
+        name = full_name.substr(0, brace);
+        labels = full_name.substr(brace + 1, full_name.size() - brace - 2);
+    }
+
+    std::string JsonEscape(const std::string& text) {
+        std::string escaped;
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (text[i] == '"' || text[i] == '\\') {
+                escaped += '\\';
+            }
+            escaped += text[i];
+        }
+        return escaped;
+    }
+
+    const char* KindName(MetricKind kind) {
+        switch (kind) {
+        case kMetricCounter:
+            return "counter";
+        case kMetricGauge:
+            return "gauge";
+        default:
+            return "histogram";
+        }
+    }
+
+    std::string HttpResponse(const std::string& status, const std::string& content_type,
+                             const std::string& body) {
+        std::ostringstream response;
+        response << "HTTP/1.1 " << status << "\r\n"
+            << "Content-Type: " << content_type << "\r\n"
+            << "Content-Length: " << body.size() << "\r\n"
+            << "Connection: close\r\n\r\n"
+            << body;
+        return response.str();
+    }
+}
+
+class StatsHttpServer::Connection : public std::enable_shared_from_this<Connection> {
+public:
+    Connection(StatsHttpServer& server, boost::asio::ip::tcp::socket socket)
+        : server_(server), socket_(std::move(socket)), request_(kMaxRequestSize) {
+    }
+
+    void Start() {
+        auto self = shared_from_this();
+        boost::asio::async_read_until(socket_, request_, "\r\n\r\n",
+            [self](const boost::system::error_code& error, std::size_t) {
+                self->OnRequest(error);
+            });
+    }
+
+private:
+    void OnRequest(const boost::system::error_code& error) {
+        if (error) {
+            return;
+        }
+        std::istream stream(&request_);
+        std::string request_line;
+        std::getline(stream, request_line);
+        response_ = server_.HandleRequest(request_line);
+
+        auto self = shared_from_this();
+        boost::asio::async_write(socket_, boost::asio::buffer(response_),
+            [self](const boost::system::error_code&, std::size_t) {
+                boost::system::error_code ec;
+                self->socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+            });
+    }
+
+private:
+    StatsHttpServer& server_;
+    boost::asio::ip::tcp::socket socket_;
+    boost::asio::streambuf request_;
+    std::string response_;
+};
+
+StatsHttpServer::StatsHttpServer(uint16_t port, const std::string& address)
+    : address_(address),
+    port_(port),
+    acceptor_(io_service_),
+    accept_socket_(io_service_),
+    rate_timer_(io_service_),
+    sample_interval_seconds_(0) {
+}
+
+StatsHttpServer::~StatsHttpServer() {
+    Stop();
+}
+
+bool StatsHttpServer::Start() {
+    boost::system::error_code ec;
+    const boost::asio::ip::tcp::endpoint endpoint(
+        boost::asio::ip::address::from_string(address_, ec), port_);
+    if (ec) {
+        LOG_ERROR << "Invalid stats address " << address_ << ENDLINE;
+        return false;
+    }
+    acceptor_.open(endpoint.protocol(), ec);
+    if (!ec) {
+        acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true), ec);
+        acceptor_.bind(endpoint, ec);
+    }
+    if (!ec) {
+        acceptor_.listen(boost::asio::socket_base::max_connections, ec);
+    }
+    if (ec) {
+        LOG_ERROR << "Stats server listen on " << address_ << ":" << port_ << " failed: "
+            << ec.message() << ENDLINE;
+        acceptor_.close(ec);
+        return false;
+    }
+
+    io_service_.reset();
+    DoAccept();
+    DoSampleRates();
+    server_thread_ = std::thread(&StatsHttpServer::Run, this);
+    return true;
+}
+
+void StatsHttpServer::Stop() {
+    io_service_.stop();
+    if (server_thread_.joinable()) {
+        server_thread_.join();
+    }
+    boost::system::error_code ec;
+    acceptor_.close(ec);
+}
+
+void StatsHttpServer::Run() {
+    LowerThreadPriority();
+    io_service_.run();
+}
+
+void StatsHttpServer::DoAccept() {
+    acceptor_.async_accept(accept_socket_, [this](const boost::system::error_code& error) {
+        if (error == boost::asio::error::operation_aborted) {
+            return;
+        }
+        if (!error) {
+            std::make_shared<Connection>(*this, std::move(accept_socket_))->Start();
+        }
+        accept_socket_ = boost::asio::ip::tcp::socket(io_service_);
+        DoAccept();
+    });
+}
+
+void StatsHttpServer::DoSampleRates() {
+    const std::vector<MetricSnapshot> snapshots = MetricsRegistry::Instance().Snapshot();
+    previous_values_.swap(current_values_);
+    current_values_.clear();
+    for (auto iter = snapshots.begin(); iter != snapshots.end(); ++iter) {
+        if (iter->kind == kMetricCounter) {
+            current_values_[iter->name] = iter->value;
+        }
+    }
+    sample_interval_seconds_ = previous_values_.empty() ? 0 : kRateSampleSeconds;
+
+    rate_timer_.expires_from_now(boost::posix_time::seconds(kRateSampleSeconds));
+    rate_timer_.async_wait([this](const boost::system::error_code& error) {
+        if (!error) {
+            DoSampleRates();
+        }
+    });
+}
+
+double StatsHttpServer::Rate(const MetricSnapshot& snapshot) const {
+    if (sample_interval_seconds_ <= 0) {
+        return 0;
+    }
+    auto current = current_values_.find(snapshot.name);
+    auto previous = previous_values_.find(snapshot.name);
+    if (current == current_values_.end() || previous == previous_values_.end()) {
+        return 0;
+    }
+    return static_cast<double>(current->second - previous->second) / sample_interval_seconds_;
+}
+
+std::string StatsHttpServer::HandleRequest(const std::string& request_line) {
+    std::istringstream stream(request_line);
+    std::string method;
+    std::string target;
+    stream >> method >> target;
+    if (method != "GET") {
+        return HttpResponse("405 Method Not Allowed", "text/plain", "Only GET is supported\n");
+    }
+    if (target == "/metrics") {
+        return HttpResponse("200 OK", "text/plain; version=0.0.4",
+            RenderPrometheus(MetricsRegistry::Instance().Snapshot()));
+    }
+    if (target == "/stats") {
+        return HttpResponse("200 OK", "application/json",
+            RenderJson(MetricsRegistry::Instance().Snapshot()));
+    }
+    return HttpResponse("404 Not Found", "text/plain", "Try /metrics or /stats\n");
+}
+
+std::string StatsHttpServer::RenderPrometheus(const std::vector<MetricSnapshot>& snapshots) {
+    struct Series {
+        std::string name;
+        std::string labels;
+        const MetricSnapshot* snapshot;
+    };
+    // The snapshot is in registration order, which interleaves the families
+    // of per interface metrics. The stable sort keeps the order within one.
+    std::vector<Series> series(snapshots.size());
+    for (size_t i = 0; i < snapshots.size(); ++i) {
+        SplitName(snapshots[i].name, series[i].name, series[i].labels);
+        series[i].snapshot = &snapshots[i];
+    }
+    std::stable_sort(series.begin(), series.end(), [](const Series& left, const Series& right) {
+        return left.name < right.name;
+    });
+
+    std::ostringstream out;
+    std::string last_name;
+    for (auto entry = series.begin(); entry != series.end(); ++entry) {
+        const MetricSnapshot* snapshot = entry->snapshot;
+        const std::string& name = entry->name;
+        const std::string& labels = entry->labels;
+        // Labelled series of one metric share the HELP and TYPE lines.
+        if (name != last_name) {
+            out << "# HELP " << name << " " << snapshot->help << "\n"
+                << "# TYPE " << name << " " << KindName(snapshot->kind) << "\n";
+            last_name = name;
+        }
+        if (snapshot->kind != kMetricHistogram) {
+            out << snapshot->name << " " << snapshot->value << "\n";
+            continue;
+        }
+        const std::string label_prefix = labels.empty() ? "" : labels + ",";
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < snapshot->bounds.size(); ++i) {
+            cumulative += snapshot->buckets[i];
+            out << name << "_bucket{" << label_prefix << "le=\"" << snapshot->bounds[i] << "\"} "
+                << cumulative << "\n";
+        }
+        out << name << "_bucket{" << label_prefix << "le=\"+Inf\"} " << snapshot->count << "\n";
+        const std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+        out << name << "_sum" << suffix << " " << snapshot->sum << "\n"
+            << name << "_count" << suffix << " " << snapshot->count << "\n";
+    }
+    return out.str();
+}
+
+std::string StatsHttpServer::RenderJson(const std::vector<MetricSnapshot>& snapshots) const {
+    std::ostringstream out;
+    out << "{\"metrics\":[";
+    for (auto iter = snapshots.begin(); iter != snapshots.end(); ++iter) {
+        if (iter != snapshots.begin()) {
+            out << ",";
+        }
+        out << "{\"name\":\"" << JsonEscape(iter->name) << "\",\"type\":\""
+            << KindName(iter->kind) << "\"";
+        switch (iter->kind) {
+        case kMetricCounter:
+            out << ",\"value\":" << iter->value << ",\"rate\":" << Rate(*iter);
+            break;
+        case kMetricGauge:
+            out << ",\"value\":" << iter->value;
+            break;
+        case kMetricHistogram:
+            out << ",\"count\":" << iter->count << ",\"sum\":" << iter->sum << ",\"buckets\":[";
+            for (size_t i = 0; i < iter->buckets.size(); ++i) {
+                out << (i > 0 ? "," : "") << "{\"le\":";
+                if (i < iter->bounds.size()) {
+                    out << iter->bounds[i];
+                }
+                else {
+                    out << "\"+Inf\"";
+                }
+                out << ",\"count\":" << iter->buckets[i] << "}";
+            }
+            out << "]";
+            break;
+        }
+        out << "}";
+    }
+    out << "]}\n";
+    return out.str();
+}
+
+void TestStatsHttpServer() {
+    StatsHttpServer server(9102);
+    if (!server.Start()) {
+        return;
+    }
+    LOG_INFO << "Serving http://127.0.0.1:9102/metrics and /stats" << ENDLINE;
+    const MetricCounter counter = MetricsRegistry::Instance().AddCounter(
+        "test_served_total", "Test events served over http");
+    for (int i = 0; i < 300; ++i) {
+        counter.Add(10);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+void TestPrometheusRender() {
+    // Registered the way RegistryMetricsPolicy::InterfaceAdded() does, the
+    // two families alternate.
+    const char* interfaces[] = { "10.0.0.1", "10.0.1.1" };
+    for (size_t i = 0; i < 2; ++i) {
+        const std::string label = std::string("{interface=\"") + interfaces[i] + "\"}";
+        MetricsRegistry::Instance().AddCounter(
+            "test_interface_packets_total" + label, "Test packets per interface").Add(10 * (i + 1));
+        MetricsRegistry::Instance().AddCounter(
+            "test_interface_bytes_total" + label, "Test bytes per interface").Add(1000 * (i + 1));
+    }
+    LOG_INFO << StatsHttpServer::RenderPrometheus(MetricsRegistry::Instance().Snapshot()) << ENDLINE;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+// Minimal HTTP/1.1 endpoint serving the MetricsRegistry:
+//   GET /metrics       Prometheus text format
+//   GET /stats         JSON, counters with their rate over the last second
+// It runs its own io_service on a low priority thread, so a slow client
+// never delays the receive handlers. Every response is rendered from a
+// snapshot copy and the connection is closed after it.
+class StatsHttpServer {
+public:
+    explicit StatsHttpServer(uint16_t port, const std::string& address = "127.0.0.1");
+    ~StatsHttpServer();
+
+    bool Start();
+    void Stop();
+
+    // Series of one family, e.g. the per interface counters, are grouped
+    // under a single HELP and TYPE line whatever order they registered in.
+    static std::string RenderPrometheus(const std::vector<MetricSnapshot>& snapshots);
+
+private:
+    class Connection;
+
+    void DoAccept();
+    void DoSampleRates();
+    std::string HandleRequest(const std::string& request_line);
+    std::string RenderJson(const std::vector<MetricSnapshot>& snapshots) const;
+    double Rate(const MetricSnapshot& snapshot) const;
+    void Run();
+
+private:
+    std::string address_;
+    uint16_t port_;
+    boost::asio::io_service io_service_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    boost::asio::ip::tcp::socket accept_socket_;
+    boost::asio::deadline_timer rate_timer_;
+    std::thread server_thread_;
+
+    // Counter values of the last two samples, only used on the server thread.
+    std::map<std::string, int64_t> previous_values_;
+    std::map<std::string, int64_t> current_values_;
+    double sample_interval_seconds_;
+};
+
+void TestStatsHttpServer();
+void TestPrometheusRender();
@@ -0,0 +1,347 @@
+#pragma once
+
+// Asynchronous logging backend. A log line is formatted into a thread local
+// buffer and copied into a per thread single producer ring, a dedicated
+// writer thread drains all the rings and hands each batch to the sink with
+// one writev per stream. The producer never takes a lock or makes a syscall,
+// when its ring is full the record is dropped and counted.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace logger {
+
+enum LogLevel : uint8_t {
+    kLogInfo = 0,
+    kLogWarn = 1,
+    kLogError = 2,
+};
+
+// Marks the end of a line, a record is always written as one line.
+struct EndLine {};
+const EndLine endline = EndLine();
+
+constexpr size_t kLogRecordSize = 256;
+constexpr size_t kLogTextSize = kLogRecordSize - 4;
+constexpr size_t kLogRingCapacity = 1024;
+constexpr size_t kLogBatchSize = 256;
+
+struct LogRecord {
+    uint16_t length;
+    uint8_t level;
+    uint8_t reserved;
+    char text[kLogTextSize];
+};
+
+// Single producer, single consumer ring of fixed size records.
+class LogRing {
+public:
+    LogRing() : head_(0), tail_(0), abandoned_(false) {}
+
+    bool Push(LogLevel level, const char* text, size_t length) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == kLogRingCapacity) {
+            return false;
+        }
+        LogRecord& record = records_[tail % kLogRingCapacity];
+        length = std::min(length, kLogTextSize);
+        memcpy(record.text, text, length);
+        record.length = static_cast<uint16_t>(length);
+        record.level = level;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Records in [head, tail) can be read by the consumer until Pop.
+    size_t Head() const { return head_.load(std::memory_order_relaxed); }
+    size_t Tail() const { return tail_.load(std::memory_order_acquire); }
+    const LogRecord& At(size_t index) const { return records_[index % kLogRingCapacity]; }
+    void Pop(size_t count) { head_.store(Head() + count, std::memory_order_release); }
+
+    bool Empty() const { return Head() == Tail(); }
+    void Abandon() { abandoned_.store(true, std::memory_order_release); }
+    bool Abandoned() const { return abandoned_.load(std::memory_order_acquire); }
+
+private:
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+    alignas(64) std::atomic<bool> abandoned_;
+    LogRecord records_[kLogRingCapacity];
+};
+
+// Destination of the lines instead of the console streams, called from the
+// writer thread only.
+class LogSink {
+public:
+    virtual ~LogSink() {}
+    virtual bool Write(const char* data, size_t size) = 0;
+};
+
+// Writes a batch of lines to stdout (info) or stderr (warn and error).
+inline void WriteBatch(int fd, const char* const* texts, const size_t* lengths, size_t count) {
+#ifdef _WIN32
+    for (size_t i = 0; i < count; ++i) {
+        _write(fd, texts[i], static_cast<unsigned int>(lengths[i]));
+    }
+#else
+    struct iovec iov[kLogBatchSize];
+    size_t iov_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        iov[iov_count].iov_base = const_cast<char*>(texts[i]);
+        iov[iov_count].iov_len = lengths[i];
+        ++iov_count;
+    }
+    struct iovec* next = iov;
+    while (iov_count > 0) {
+        ssize_t written = ::writev(fd, next, static_cast<int>(iov_count));
+        if (written < 0) {
+            return;
+        }
+        // Skip the fully written buffers and resume a partial one.
+        while (iov_count > 0 && static_cast<size_t>(written) >= next->iov_len) {
+            written -= next->iov_len;
+            ++next;
+            --iov_count;
+        }
+        if (iov_count > 0) {
+            next->iov_base = static_cast<char*>(next->iov_base) + written;
+            next->iov_len -= written;
+        }
+    }
+#endif
+}
+
+class AsyncLogger {
+public:
+    // Never destroyed, so logging from static destructors stays safe. The
+    // writer is stopped and the rings flushed at exit.
+    static AsyncLogger& Instance() {
+        static AsyncLogger* instance = new AsyncLogger();
+        return *instance;
+    }
+
+    bool Write(LogLevel level, const char* text, size_t length) {
+        if (stopped_.load(std::memory_order_acquire)) {
+            const char* texts[] = { text };
+            WriteBatch(level == kLogInfo ? 1 : 2, texts, &length, 1);
+            return true;
+        }
+        if (!ThreadRing()->Push(level, text, length)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Blocks until the records pushed by this thread have been written.
+    void Flush() {
+        LogRing* ring = ThreadRing();
+        while (!ring->Empty() && !stopped_.load(std::memory_order_acquire)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    uint64_t DroppedCount() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    // Sends all the lines to |sink|, nullptr restores the console. The sink
+    // has to outlive the logger or be reset before it is destroyed.
+    void SetSink(LogSink* sink) {
+        sink_.store(sink, std::memory_order_release);
+    }
+
+private:
+    struct RingHolder {
+        std::shared_ptr<LogRing> ring;
+        ~RingHolder() {
+            if (ring) {
+                ring->Abandon();
+            }
+        }
+    };
+
+    AsyncLogger() : sink_(nullptr), stop_(false), stopped_(false), dropped_(0) {
+        writer_ = std::thread(&AsyncLogger::Run, this);
+        std::atexit(&AsyncLogger::Shutdown);
+    }
+
+    static void Shutdown() {
+        AsyncLogger& instance = Instance();
+        instance.stop_.store(true, std::memory_order_release);
+        if (instance.writer_.joinable()) {
+            instance.writer_.join();
+        }
+    }
+
+    LogRing* ThreadRing() {
+        thread_local RingHolder holder;
+        if (!holder.ring) {
+            holder.ring = std::make_shared<LogRing>();
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            rings_.push_back(holder.ring);
+        }
+        return holder.ring.get();
+    }
+
+    void Run() {
+        std::vector<std::shared_ptr<LogRing>> rings;
+        for (;;) {
+            const bool stop = stop_.load(std::memory_order_acquire);
+            {
+                std::lock_guard<std::mutex> lock(rings_mutex_);
+                rings = rings_;
+            }
+            size_t written = 0;
+            for (auto iter = rings.begin(); iter != rings.end(); ++iter) {
+                written += Drain(**iter);
+            }
+            if (stop) {
+                break;
+            }
+            if (written == 0) {
+                RemoveAbandonedRings();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        stopped_.store(true, std::memory_order_release);
+    }
+
+    size_t Drain(LogRing& ring) {
+        size_t total = 0;
+        for (;;) {
+            const size_t head = ring.Head();
+            const size_t count = std::min(ring.Tail() - head, kLogBatchSize);
+            if (count == 0) {
+                return total;
+            }
+            LogSink* sink = sink_.load(std::memory_order_acquire);
+            if (sink) {
+                for (size_t i = 0; i < count; ++i) {
+                    const LogRecord& record = ring.At(head + i);
+                    sink->Write(record.text, record.length);
+                }
+                ring.Pop(count);
+                total += count;
+                continue;
+            }
+            const char* out_texts[kLogBatchSize];
+            size_t out_lengths[kLogBatchSize];
+            const char* err_texts[kLogBatchSize];
+            size_t err_lengths[kLogBatchSize];
+            size_t out_count = 0;
+            size_t err_count = 0;
+            for (size_t i = 0; i < count; ++i) {
+                const LogRecord& record = ring.At(head + i);
+                if (record.level == kLogInfo) {
+                    out_texts[out_count] = record.text;
+                    out_lengths[out_count++] = record.length;
+                }
+                else {
+                    err_texts[err_count] = record.text;
+                    err_lengths[err_count++] = record.length;
+                }
+            }
+            WriteBatch(1, out_texts, out_lengths, out_count);
+            WriteBatch(2, err_texts, err_lengths, err_count);
+            ring.Pop(count);
+            total += count;
+        }
+    }
+
+    void RemoveAbandonedRings() {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.erase(std::remove_if(rings_.begin(), rings_.end(),
+            [](const std::shared_ptr<LogRing>& ring) {
+                return ring->Abandoned() && ring->Empty();
+            }), rings_.end());
+    }
+
+private:
+    std::mutex rings_mutex_;
+    std::vector<std::shared_ptr<LogRing>> rings_;
+    std::thread writer_;
+    std::atomic<LogSink*> sink_;
+    std::atomic<bool> stop_;
+    std::atomic<bool> stopped_;
+    std::atomic<uint64_t> dropped_;
+};
+
+// Fixed size stream buffer, the text beyond kLogTextSize is truncated.
+class LogStreamBuf : public std::streambuf {
+public:
+    LogStreamBuf() { Reset(); }
+    void Reset() { setp(buffer_, buffer_ + kLogTextSize - 1); }
+    char* Data() { return buffer_; }
+    size_t Size() const { return static_cast<size_t>(pptr() - pbase()); }
+
+private:
+    char buffer_[kLogTextSize];
+};
+
+// A log line, it is formatted while the full expression is evaluated and
+// pushed to the ring when the temporary is destroyed. The formatting stream
+// is reused by all the lines of a thread.
+class LogLine {
+public:
+    explicit LogLine(LogLevel level) : level_(level), stream_(ThreadStream()) {
+        static_cast<LogStreamBuf*>(stream_.rdbuf())->Reset();
+        // A truncated line leaves the stream in the bad state.
+        stream_.clear();
+    }
+
+    ~LogLine() {
+        LogStreamBuf* buffer = static_cast<LogStreamBuf*>(stream_.rdbuf());
+        size_t size = buffer->Size();
+        if (size == 0 || buffer->Data()[size - 1] != '\n') {
+            buffer->Data()[size++] = '\n';
+        }
+        AsyncLogger::Instance().Write(level_, buffer->Data(), size);
+    }
+
+    template <typename T>
+    LogLine& operator<<(const T& value) {
+        stream_ << value;
+        return *this;
+    }
+
+    LogLine& operator<<(const EndLine&) {
+        return *this;
+    }
+
+    LogLine& operator<<(std::ostream& (*manipulator)(std::ostream&)) {
+        manipulator(stream_);
+        return *this;
+    }
+
+private:
+    static std::ostream& ThreadStream() {
+        thread_local LogStreamBuf buffer;
+        thread_local std::ostream stream(&buffer);
+        return stream;
+    }
+
+private:
+    LogLevel level_;
+    std::ostream& stream_;
+};
+
+} // namespace logger
@@ -0,0 +1,171 @@
+#pragma once
+
+// Encoding of the binary log entries, shared by the binary logger and the
+// flight recorder. The argument types are listed in binary_log_format.h.
+
+#include <atomic>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+
+#include "tsc_clock.h"
+
+namespace logger {
+
+// Timestamp of a binary entry, TscClock ticks.
+inline uint64_t ReadTimestamp() {
+    return TscClock::ReadTicks();
+}
+
+// Logs an ip v4 address given in host byte order, decoded as a.b.c.d.
+struct IpV4 {
+    explicit IpV4(uint32_t ip) : value(ip) {}
+    uint32_t value;
+};
+
+struct FormatDescriptor {
+    const char* file;
+    uint32_t line;
+    uint8_t level;
+    const char* format;
+    const char* arg_types;
+};
+
+// Static state of a call site, zero initialized so no guard is needed.
+struct BinaryLogSite {
+    std::atomic<uint32_t> id;
+};
+
+// Encoding of one argument type, see binary_log_format.h.
+template <typename T, typename Enable = void>
+struct BinaryArg;
+
+template <>
+struct BinaryArg<bool> {
+    static constexpr char kType = 'b';
+    static size_t Size(bool) { return 1; }
+    static char* Encode(char* out, bool value) {
+        *out = value ? 1 : 0;
+        return out + 1;
+    }
+};
+
+template <>
+struct BinaryArg<char> {
+    static constexpr char kType = 'c';
+    static size_t Size(char) { return 1; }
+    static char* Encode(char* out, char value) {
+        *out = value;
+        return out + 1;
+    }
+};
+
+template <typename T>
+struct BinaryArg<T, typename std::enable_if<std::is_integral<T>::value &&
+    std::is_signed<T>::value && !std::is_same<T, char>::value>::type> {
+    static constexpr char kType = 'i';
+    static size_t Size(T) { return 8; }
+    static char* Encode(char* out, T value) {
+        const int64_t encoded = value;
+        memcpy(out, &encoded, 8);
+        return out + 8;
+    }
+};
+
+template <typename T>
+struct BinaryArg<T, typename std::enable_if<std::is_integral<T>::value &&
+    std::is_unsigned<T>::value && !std::is_same<T, bool>::value &&
+    !std::is_same<T, char>::value>::type> {
+    static constexpr char kType = 'u';
+    static size_t Size(T) { return 8; }
+    static char* Encode(char* out, T value) {
+        const uint64_t encoded = value;
+        memcpy(out, &encoded, 8);
+        return out + 8;
+    }
+};
+
+template <typename T>
+struct BinaryArg<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static constexpr char kType = 'd';
+    static size_t Size(T) { return 8; }
+    static char* Encode(char* out, T value) {
+        const double encoded = value;
+        memcpy(out, &encoded, 8);
+        return out + 8;
+    }
+};
+
+template <>
+struct BinaryArg<IpV4> {
+    static constexpr char kType = 'a';
+    static size_t Size(const IpV4&) { return 4; }
+    static char* Encode(char* out, const IpV4& ip) {
+        memcpy(out, &ip.value, 4);
+        return out + 4;
+    }
+};
+
+template <>
+struct BinaryArg<const char*> {
+    static constexpr char kType = 's';
+    static size_t Size(const char* value) { return 4 + strlen(value); }
+    static char* Encode(char* out, const char* value) {
+        const uint32_t length = static_cast<uint32_t>(strlen(value));
+        memcpy(out, &length, 4);
+        memcpy(out + 4, value, length);
+        return out + 4 + length;
+    }
+};
+
+template <>
+struct BinaryArg<char*> : BinaryArg<const char*> {};
+
+template <>
+struct BinaryArg<std::string> {
+    static constexpr char kType = 's';
+    static size_t Size(const std::string& value) { return 4 + value.size(); }
+    static char* Encode(char* out, const std::string& value) {
+        const uint32_t length = static_cast<uint32_t>(value.size());
+        memcpy(out, &length, 4);
+        memcpy(out + 4, value.data(), length);
+        return out + 4 + length;
+    }
+};
+
+template <typename T>
+using BinaryArgOf = BinaryArg<typename std::decay<T>::type>;
+
+template <typename... Args>
+struct BinaryArgTypes {
+    static constexpr char value[] = { BinaryArgOf<Args>::kType..., '\0' };
+};
+
+template <typename... Args>
+constexpr char BinaryArgTypes<Args...>::value[];
+
+// The BinaryArgTypes of a call's arguments, only used unevaluated by the
+// macros to build the descriptor of a call site.
+template <typename... Args>
+BinaryArgTypes<Args...> BinaryArgTypesOf(const char* format, const Args&... args);
+
+inline size_t BinaryArgsSize() {
+    return 0;
+}
+
+template <typename T, typename... Args>
+inline size_t BinaryArgsSize(const T& value, const Args&... args) {
+    return BinaryArgOf<T>::Size(value) + BinaryArgsSize(args...);
+}
+
+inline char* EncodeBinaryArgs(char* out) {
+    return out;
+}
+
+template <typename T, typename... Args>
+inline char* EncodeBinaryArgs(char* out, const T& value, const Args&... args) {
+    return EncodeBinaryArgs(BinaryArgOf<T>::Encode(out, value), args...);
+}
+
+} // namespace logger
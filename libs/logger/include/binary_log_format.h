@@ -0,0 +1,48 @@
+#pragma once
+
+// Layout of the binary log file, shared by the binary logger and the
+// decoder. All the fields are in the byte order of the writing host.
+//
+//   BinaryLogFileHeader
+//   BinaryLogEntryHeader + payload, repeated
+//
+// An entry with id kDescriptorEntryId carries a format descriptor:
+//   uint32 descriptor id, uint32 line, uint8 level,
+//   file, format and argument types as zero terminated strings.
+// The level is one of the LOG_LEVEL_* values or kTraceLevel.
+// Any other id refers to a descriptor, the payload holds the arguments
+// encoded as listed by the descriptor's argument types:
+//   'b' bool, 1 byte          'c' char, 1 byte
+//   'i' signed, int64         'u' unsigned, uint64
+//   'd' floating, double      'a' ip v4 address, uint32 host order
+//   's' string, uint32 length + bytes
+// Descriptors may follow the entries which use them, a reader has to load
+// all the descriptors first.
+
+#include <stdint.h>
+
+namespace logger {
+
+const char kBinaryLogMagic[4] = { 'B', 'L', 'O', 'G' };
+constexpr uint32_t kBinaryLogVersion = 1;
+constexpr uint32_t kDescriptorEntryId = 0;
+// Level of the flight recorder trace events, they have no log level.
+constexpr uint8_t kTraceLevel = 0xFF;
+
+struct BinaryLogFileHeader {
+    char magic[4];
+    uint32_t version;
+    // Timestamp of the entries and the wall clock at the same instant,
+    // used to convert the timestamps to the wall clock.
+    uint64_t base_timestamp;
+    uint64_t base_realtime_ns;
+    double timestamp_ticks_per_ns;
+};
+
+struct BinaryLogEntryHeader {
+    uint32_t id;
+    uint32_t size;
+    uint64_t timestamp;
+};
+
+} // namespace logger
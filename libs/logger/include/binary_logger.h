@@ -0,0 +1,376 @@
+#pragma once
+
+// Binary logging with deferred formatting. Every LOG_BINARY call site owns a
+// constexpr format descriptor built from its format string and argument
+// types at compile time. The id of a descriptor is its position in the log
+// file, so it is handed out on the first call. A call only copies
+// the descriptor id, a timestamp and the raw arguments into a per thread
+// ring, the writer thread appends the entries to a binary file and the
+// log_decoder tool formats them afterwards. Every call is also kept by the
+// flight recorder, see flight_recorder.h.
+//
+//   logger::BinaryLogger::Instance().Open("detector.blog");
+//   LOG_BINARY(LOG_LEVEL_WARN, "Receive error {} on {}", error.value(), logger::IpV4(ip));
+//
+// "{}" is replaced by the next argument when the log is decoded.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "binary_log_args.h"
+#include "binary_log_format.h"
+#include "flight_recorder.h"
+#include "logger.h"
+
+namespace logger {
+
+// Single producer, single consumer byte ring. Entries are 8 byte aligned
+// and never wrap, the tail of the buffer is skipped with a padding entry.
+class BinaryRing {
+public:
+    static constexpr size_t kCapacity = 1 << 18;
+    static constexpr uint32_t kPaddingId = 0xFFFFFFFF;
+
+    BinaryRing() : head_(0), tail_(0), abandoned_(false) {}
+
+    static size_t Align(size_t size) { return (size + 7) & ~static_cast<size_t>(7); }
+
+    // Returns nullptr if the ring is full, otherwise the entry has to be
+    // committed before the next reservation.
+    char* Reserve(size_t size) {
+        size = Align(size);
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t offset = tail & (kCapacity - 1);
+        const size_t contiguous = kCapacity - offset;
+        const size_t needed = size <= contiguous ? size : contiguous + size;
+        if (kCapacity - (tail - head_.load(std::memory_order_acquire)) < needed) {
+            return nullptr;
+        }
+        if (size > contiguous) {
+            const uint32_t padding = kPaddingId;
+            memcpy(buffer_ + offset, &padding, 4);
+            tail += contiguous;
+        }
+        reserved_tail_ = tail + size;
+        return buffer_ + (tail & (kCapacity - 1));
+    }
+
+    void Commit() { tail_.store(reserved_tail_, std::memory_order_release); }
+
+    size_t Head() const { return head_.load(std::memory_order_relaxed); }
+    size_t Tail() const { return tail_.load(std::memory_order_acquire); }
+    const char* At(size_t position) const { return buffer_ + (position & (kCapacity - 1)); }
+    void Pop(size_t position) { head_.store(position, std::memory_order_release); }
+
+    bool Empty() const { return Head() == Tail(); }
+    void Abandon() { abandoned_.store(true, std::memory_order_release); }
+    bool Abandoned() const { return abandoned_.load(std::memory_order_acquire); }
+
+private:
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+    size_t reserved_tail_;
+    std::atomic<bool> abandoned_;
+    alignas(64) char buffer_[kCapacity];
+};
+
+class BinaryLogger {
+public:
+    static constexpr uint32_t kMaxDescriptors = 4096;
+
+    // Never destroyed, the writer is stopped and the file flushed at exit.
+    static BinaryLogger& Instance() {
+        static BinaryLogger* instance = new BinaryLogger();
+        return *instance;
+    }
+
+    // Starts writing to |path|, the calls before are dropped.
+    bool Open(const std::string& path) {
+        std::lock_guard<std::mutex> lock(open_mutex_);
+        if (file_) {
+            return false;
+        }
+#ifdef _MSC_VER
+        if (fopen_s(&file_, path.c_str(), "wb") != 0) {
+            file_ = nullptr;
+        }
+#else
+        file_ = fopen(path.c_str(), "wb");
+#endif
+        if (!file_) {
+            return false;
+        }
+        WriteFileHeader();
+        writer_ = std::thread(&BinaryLogger::Run, this);
+        std::atexit(&BinaryLogger::Shutdown);
+        opened_.store(true, std::memory_order_release);
+        return true;
+    }
+
+    bool IsOpen() const {
+        return opened_.load(std::memory_order_relaxed);
+    }
+
+    uint32_t Register(BinaryLogSite& site, const FormatDescriptor& descriptor) {
+        std::lock_guard<std::mutex> lock(descriptor_mutex_);
+        uint32_t id = site.id.load(std::memory_order_relaxed);
+        if (id != 0) {
+            return id;
+        }
+        const uint32_t count = descriptor_count_.load(std::memory_order_relaxed);
+        if (count == kMaxDescriptors) {
+            return 0;
+        }
+        descriptors_[count] = descriptor;
+        descriptor_count_.store(count + 1, std::memory_order_release);
+        // Ids start from 1, 0 is kDescriptorEntryId.
+        id = count + 1;
+        site.id.store(id, std::memory_order_release);
+        return id;
+    }
+
+    uint32_t DescriptorCount() const {
+        return descriptor_count_.load(std::memory_order_acquire);
+    }
+
+    const FormatDescriptor& Descriptor(uint32_t id) const {
+        return descriptors_[id - 1];
+    }
+
+    template <typename... Args>
+    bool Log(uint32_t id, const Args&... args) {
+        const size_t size = BinaryArgsSize(args...);
+        BinaryRing* ring = ThreadRing();
+        char* entry = ring->Reserve(sizeof(BinaryLogEntryHeader) + size);
+        if (!entry) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        BinaryLogEntryHeader header = { id, static_cast<uint32_t>(size), ReadTimestamp() };
+        memcpy(entry, &header, sizeof(header));
+        EncodeBinaryArgs(entry + sizeof(header), args...);
+        ring->Commit();
+        return true;
+    }
+
+    uint64_t DroppedCount() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct RingHolder {
+        std::shared_ptr<BinaryRing> ring;
+        ~RingHolder() {
+            if (ring) {
+                ring->Abandon();
+            }
+        }
+    };
+
+    BinaryLogger()
+        : file_(nullptr), opened_(false), stop_(false), descriptor_count_(0),
+        written_descriptors_(0), dropped_(0) {
+        FlightRecorder::Instance().SetDescriptors(descriptors_, &descriptor_count_);
+    }
+
+    static void Shutdown() {
+        BinaryLogger& instance = Instance();
+        instance.stop_.store(true, std::memory_order_release);
+        if (instance.writer_.joinable()) {
+            instance.writer_.join();
+        }
+        fclose(instance.file_);
+    }
+
+    BinaryRing* ThreadRing() {
+        thread_local RingHolder holder;
+        if (!holder.ring) {
+            holder.ring = std::make_shared<BinaryRing>();
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            rings_.push_back(holder.ring);
+        }
+        return holder.ring.get();
+    }
+
+    void WriteFileHeader() {
+        const TscClock& clock = TscClock::Instance();
+        BinaryLogFileHeader header;
+        memcpy(header.magic, kBinaryLogMagic, sizeof(header.magic));
+        header.version = kBinaryLogVersion;
+        header.base_timestamp = ReadTimestamp();
+        header.base_realtime_ns = clock.ToRealtimeNanoseconds(header.base_timestamp);
+        header.timestamp_ticks_per_ns = clock.TicksPerNanosecond();
+        fwrite(&header, sizeof(header), 1, file_);
+    }
+
+    void WriteDescriptors() {
+        const uint32_t count = DescriptorCount();
+        for (; written_descriptors_ < count; ++written_descriptors_) {
+            const FormatDescriptor& descriptor = descriptors_[written_descriptors_];
+            const uint32_t id = written_descriptors_ + 1;
+            const size_t file_length = strlen(descriptor.file) + 1;
+            const size_t format_length = strlen(descriptor.format) + 1;
+            const size_t types_length = strlen(descriptor.arg_types) + 1;
+            BinaryLogEntryHeader header = { kDescriptorEntryId, static_cast<uint32_t>(
+                9 + file_length + format_length + types_length), 0 };
+            fwrite(&header, sizeof(header), 1, file_);
+            fwrite(&id, 4, 1, file_);
+            fwrite(&descriptor.line, 4, 1, file_);
+            fwrite(&descriptor.level, 1, 1, file_);
+            fwrite(descriptor.file, file_length, 1, file_);
+            fwrite(descriptor.format, format_length, 1, file_);
+            fwrite(descriptor.arg_types, types_length, 1, file_);
+        }
+    }
+
+    size_t Drain(BinaryRing& ring) {
+        size_t position = ring.Head();
+        const size_t tail = ring.Tail();
+        size_t count = 0;
+        while (position != tail) {
+            const char* entry = ring.At(position);
+            BinaryLogEntryHeader header;
+            memcpy(&header.id, entry, 4);
+            if (header.id == BinaryRing::kPaddingId) {
+                position += BinaryRing::kCapacity - (position & (BinaryRing::kCapacity - 1));
+                continue;
+            }
+            memcpy(&header, entry, sizeof(header));
+            const size_t size = sizeof(header) + header.size;
+            fwrite(entry, size, 1, file_);
+            position += BinaryRing::Align(size);
+            ++count;
+        }
+        ring.Pop(position);
+        return count;
+    }
+
+    void Run() {
+        std::vector<std::shared_ptr<BinaryRing>> rings;
+        for (;;) {
+            const bool stop = stop_.load(std::memory_order_acquire);
+            {
+                std::lock_guard<std::mutex> lock(rings_mutex_);
+                rings = rings_;
+            }
+            WriteDescriptors();
+            size_t written = 0;
+            for (auto iter = rings.begin(); iter != rings.end(); ++iter) {
+                written += Drain(**iter);
+            }
+            if (stop) {
+                // Entries logged by a call site registered during the drain.
+                WriteDescriptors();
+                break;
+            }
+            if (written == 0) {
+                fflush(file_);
+                std::lock_guard<std::mutex> lock(rings_mutex_);
+                rings_.erase(std::remove_if(rings_.begin(), rings_.end(),
+                    [](const std::shared_ptr<BinaryRing>& ring) {
+                        return ring->Abandoned() && ring->Empty();
+                    }), rings_.end());
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        fflush(file_);
+    }
+
+private:
+    std::mutex open_mutex_;
+    FILE* file_;
+    std::atomic<bool> opened_;
+    std::atomic<bool> stop_;
+    std::thread writer_;
+
+    std::mutex rings_mutex_;
+    std::vector<std::shared_ptr<BinaryRing>> rings_;
+
+    std::mutex descriptor_mutex_;
+    FormatDescriptor descriptors_[kMaxDescriptors];
+    std::atomic<uint32_t> descriptor_count_;
+    uint32_t written_descriptors_;
+    std::atomic<uint64_t> dropped_;
+};
+
+// Id of the call site's descriptor, registered on the first call. Zero when
+// the descriptor table is full.
+inline uint32_t BinaryLogSiteId(BinaryLogSite& site, const FormatDescriptor& descriptor) {
+    const uint32_t id = site.id.load(std::memory_order_acquire);
+    if (id != 0) {
+        return id;
+    }
+    return BinaryLogger::Instance().Register(site, descriptor);
+}
+
+// Records the call into the flight recorder and, once opened, the binary
+// log. |format| is already in |descriptor|.
+template <typename... Args>
+inline void BinaryLog(BinaryLogSite& site, const FormatDescriptor& descriptor,
+                      const char* /*format*/, const Args&... args) {
+    const uint32_t id = BinaryLogSiteId(site, descriptor);
+    if (id == 0) {
+        return;
+    }
+    FlightRecorder::Instance().Record(id, args...);
+    BinaryLogger& binary_logger = BinaryLogger::Instance();
+    if (binary_logger.IsOpen()) {
+        binary_logger.Log(id, args...);
+    }
+}
+
+// Records the call into the flight recorder only.
+template <typename... Args>
+inline void FlightTrace(BinaryLogSite& site, const FormatDescriptor& descriptor,
+                        const char* /*format*/, const Args&... args) {
+    const uint32_t id = BinaryLogSiteId(site, descriptor);
+    if (id != 0) {
+        FlightRecorder::Instance().Record(id, args...);
+    }
+}
+
+} // namespace logger
+
+// The format string of a call, the first of the macro arguments. The
+// expansion step makes MSVC split __VA_ARGS__ into arguments.
+#define LOGGER_EXPAND(x) x
+#define LOGGER_FIRST_ARG_(first, ...) first
+#define LOGGER_FIRST_ARG(...) LOGGER_EXPAND(LOGGER_FIRST_ARG_(__VA_ARGS__, unused))
+
+// The descriptor of the call site, a constant in the binary.
+#define LOGGER_SITE_DESCRIPTOR(name, level, ...)                                    \
+    static constexpr logger::FormatDescriptor name = { __FILE__, __LINE__,          \
+        static_cast<uint8_t>(level), LOGGER_FIRST_ARG(__VA_ARGS__),                 \
+        decltype(logger::BinaryArgTypesOf(__VA_ARGS__))::value }
+
+// The level checks are the same as for the text macros in logger.h.
+#define LOG_BINARY(level, ...)                                                      \
+    do {                                                                            \
+        if ((level) >= LOG_COMPILE_LEVEL && logger::IsLogLevelEnabled(level)) {     \
+            LOGGER_SITE_DESCRIPTOR(_log_binary_descriptor, (level), __VA_ARGS__);   \
+            static logger::BinaryLogSite _log_binary_site;                          \
+            logger::BinaryLog(_log_binary_site, _log_binary_descriptor,             \
+                __VA_ARGS__);                                                       \
+        }                                                                           \
+    } while (0)
+
+// Trace events are always recorded, they have no level.
+#define FLIGHT_TRACE(...)                                                           \
+    do {                                                                            \
+        LOGGER_SITE_DESCRIPTOR(_flight_trace_descriptor, logger::kTraceLevel,       \
+            __VA_ARGS__);                                                           \
+        static logger::BinaryLogSite _flight_trace_site;                            \
+        logger::FlightTrace(_flight_trace_site, _flight_trace_descriptor,           \
+            __VA_ARGS__);                                                           \
+    } while (0)
@@ -0,0 +1,332 @@
+#pragma once
+
+// Always on flight recorder. Every thread keeps its last FlightRing::kSlots
+// binary log and trace events in a fixed ring, recording one costs a
+// timestamp and a copy of the arguments, nothing is written out. After
+// Install() the rings are dumped to a binary log on SIGSEGV and SIGABRT, and
+// on demand on SIGUSR1 where it exists. The dump only uses async signal safe
+// calls, log_decoder reads it like any other binary log.
+//
+//   logger::FlightRecorder::Instance().Install("detector.flight.blog");
+//   FLIGHT_TRACE("Received {} bytes on {}", bytes_transferred, ip);
+//
+// FLIGHT_TRACE and LOG_BINARY are defined in binary_logger.h.
+
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include "binary_log_args.h"
+#include "binary_log_format.h"
+#include "tsc_clock.h"
+
+namespace logger {
+
+// Events of one thread, overwritten in a circle. A dump taken while the
+// owner records may contain one torn event.
+struct FlightRing {
+    static constexpr size_t kSlots = 1024;
+    static constexpr size_t kSlotSize = 128;
+    static constexpr size_t kMaxPayload = kSlotSize - sizeof(BinaryLogEntryHeader);
+
+    std::atomic<uint64_t> count;
+    std::atomic<bool> in_use;
+    char slots[kSlots][kSlotSize];
+};
+
+class FlightRecorder {
+public:
+    static constexpr uint32_t kMaxRings = 256;
+
+    // Never destroyed, a signal may arrive during the static destruction.
+    static FlightRecorder& Instance() {
+        static FlightRecorder* instance = new FlightRecorder();
+        return *instance;
+    }
+
+    // Sets the dump file and installs the signal handlers.
+    bool Install(const std::string& path) {
+        if (path.size() >= sizeof(path_)) {
+            return false;
+        }
+        memcpy(path_, path.c_str(), path.size() + 1);
+
+        // The handler can't calibrate, the conversion is taken now.
+        const TscClock& clock = TscClock::Instance();
+        memcpy(file_header_.magic, kBinaryLogMagic, sizeof(file_header_.magic));
+        file_header_.version = kBinaryLogVersion;
+        file_header_.base_timestamp = ReadTimestamp();
+        file_header_.base_realtime_ns = clock.ToRealtimeNanoseconds(file_header_.base_timestamp);
+        file_header_.timestamp_ticks_per_ns = clock.TicksPerNanosecond();
+        installed_.store(true, std::memory_order_release);
+
+#ifdef _WIN32
+        signal(SIGSEGV, &FlightRecorder::HandleSignal);
+        signal(SIGABRT, &FlightRecorder::HandleSignal);
+#else
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = &FlightRecorder::HandleSignal;
+        sigemptyset(&action.sa_mask);
+        // The fatal signals are raised again with the default action.
+        action.sa_flags = SA_RESETHAND;
+        sigaction(SIGSEGV, &action, nullptr);
+        sigaction(SIGABRT, &action, nullptr);
+        sigaction(SIGBUS, &action, nullptr);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &action, nullptr);
+#endif
+        return true;
+    }
+
+    // Descriptors written ahead of the events, set by the binary logger.
+    void SetDescriptors(const FormatDescriptor* descriptors,
+                        const std::atomic<uint32_t>* descriptor_count) {
+        descriptors_ = descriptors;
+        descriptor_count_.store(descriptor_count, std::memory_order_release);
+    }
+
+    // Events whose arguments don't fit a slot are kept without them.
+    template <typename... Args>
+    void Record(uint32_t id, const Args&... args) {
+        FlightRing* ring = ThreadRing();
+        if (!ring) {
+            return;
+        }
+        const uint64_t count = ring->count.load(std::memory_order_relaxed);
+        char* slot = ring->slots[count & (FlightRing::kSlots - 1)];
+        size_t size = BinaryArgsSize(args...);
+        if (size <= FlightRing::kMaxPayload) {
+            EncodeBinaryArgs(slot + sizeof(BinaryLogEntryHeader), args...);
+        }
+        else {
+            size = 0;
+        }
+        const BinaryLogEntryHeader header = { id, static_cast<uint32_t>(size), ReadTimestamp() };
+        memcpy(slot, &header, sizeof(header));
+        ring->count.store(count + 1, std::memory_order_release);
+    }
+
+    // Writes the rings to the installed path, events of all the threads
+    // merged by time. Async signal safe, returns false if not installed or
+    // another dump is running.
+    bool Dump() {
+        if (!installed_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        bool dumping = false;
+        if (!dumping_.compare_exchange_strong(dumping, true)) {
+            return false;
+        }
+        const int fd = OpenDumpFile();
+        if (fd >= 0) {
+            WriteAll(fd, &file_header_, sizeof(file_header_));
+            WriteDescriptors(fd);
+            WriteEvents(fd);
+            CloseDumpFile(fd);
+        }
+        dumping_.store(false);
+        return fd >= 0;
+    }
+
+private:
+    struct RingHolder {
+        RingHolder() : ring(nullptr), exhausted(false) {}
+        ~RingHolder() {
+            if (ring) {
+                // The events stay for the dump until another thread takes it.
+                ring->in_use.store(false, std::memory_order_release);
+            }
+        }
+        FlightRing* ring;
+        bool exhausted;
+    };
+
+    FlightRecorder()
+        : descriptors_(nullptr), descriptor_count_(nullptr), ring_count_(0),
+        installed_(false), dumping_(false) {
+        path_[0] = '\0';
+        memset(&file_header_, 0, sizeof(file_header_));
+        for (uint32_t i = 0; i < kMaxRings; ++i) {
+            rings_[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    static void HandleSignal(int signal_number) {
+        Instance().Dump();
+#ifdef SIGUSR1
+        if (signal_number == SIGUSR1) {
+            return;
+        }
+#endif
+        signal(signal_number, SIG_DFL);
+        raise(signal_number);
+    }
+
+    FlightRing* ThreadRing() {
+        thread_local RingHolder holder;
+        if (!holder.ring && !holder.exhausted) {
+            holder.ring = AcquireRing();
+            holder.exhausted = holder.ring == nullptr;
+        }
+        return holder.ring;
+    }
+
+    // Reuses the ring of an exited thread, rings are never freed since a
+    // signal handler may read them at any time.
+    FlightRing* AcquireRing() {
+        const uint32_t count = RingCount();
+        for (uint32_t i = 0; i < count; ++i) {
+            FlightRing* ring = rings_[i].load(std::memory_order_acquire);
+            bool in_use = false;
+            if (ring && ring->in_use.compare_exchange_strong(in_use, true)) {
+                return ring;
+            }
+        }
+        const uint32_t index = ring_count_.fetch_add(1);
+        if (index >= kMaxRings) {
+            return nullptr;
+        }
+        FlightRing* ring = new FlightRing();
+        ring->count.store(0, std::memory_order_relaxed);
+        ring->in_use.store(true, std::memory_order_relaxed);
+        rings_[index].store(ring, std::memory_order_release);
+        return ring;
+    }
+
+    uint32_t RingCount() const {
+        const uint32_t count = ring_count_.load(std::memory_order_acquire);
+        return count < kMaxRings ? count : kMaxRings;
+    }
+
+    int OpenDumpFile() const {
+#ifdef _WIN32
+        int fd = -1;
+        if (_sopen_s(&fd, path_, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+            _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0) {
+            return -1;
+        }
+        return fd;
+#else
+        return open(path_, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    }
+
+    static void CloseDumpFile(int fd) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+    }
+
+    static void WriteAll(int fd, const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+#ifdef _WIN32
+            const int written = _write(fd, bytes, static_cast<unsigned int>(size));
+#else
+            const ssize_t written = write(fd, bytes, size);
+#endif
+            if (written <= 0) {
+                return;
+            }
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    void WriteDescriptors(int fd) const {
+        const std::atomic<uint32_t>* descriptor_count =
+            descriptor_count_.load(std::memory_order_acquire);
+        if (!descriptor_count) {
+            return;
+        }
+        const uint32_t count = descriptor_count->load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < count; ++i) {
+            const FormatDescriptor& descriptor = descriptors_[i];
+            const uint32_t id = i + 1;
+            const size_t file_length = strlen(descriptor.file) + 1;
+            const size_t format_length = strlen(descriptor.format) + 1;
+            const size_t types_length = strlen(descriptor.arg_types) + 1;
+            const BinaryLogEntryHeader header = { kDescriptorEntryId, static_cast<uint32_t>(
+                9 + file_length + format_length + types_length), 0 };
+            WriteAll(fd, &header, sizeof(header));
+            WriteAll(fd, &id, 4);
+            WriteAll(fd, &descriptor.line, 4);
+            WriteAll(fd, &descriptor.level, 1);
+            WriteAll(fd, descriptor.file, file_length);
+            WriteAll(fd, descriptor.format, format_length);
+            WriteAll(fd, descriptor.arg_types, types_length);
+        }
+    }
+
+    void WriteEvents(int fd) const {
+        const uint32_t count = RingCount();
+        uint64_t cursors[kMaxRings];
+        uint64_t ends[kMaxRings];
+        for (uint32_t i = 0; i < count; ++i) {
+            const FlightRing* ring = rings_[i].load(std::memory_order_acquire);
+            ends[i] = ring ? ring->count.load(std::memory_order_acquire) : 0;
+            cursors[i] = ends[i] > FlightRing::kSlots ? ends[i] - FlightRing::kSlots : 0;
+        }
+        for (;;) {
+            // The oldest pending event of all the rings.
+            const char* oldest = nullptr;
+            uint32_t oldest_ring = 0;
+            uint64_t oldest_timestamp = 0;
+            for (uint32_t i = 0; i < count; ++i) {
+                if (cursors[i] == ends[i]) {
+                    continue;
+                }
+                const char* slot = rings_[i].load(std::memory_order_relaxed)->slots[
+                    cursors[i] & (FlightRing::kSlots - 1)];
+                BinaryLogEntryHeader header;
+                memcpy(&header, slot, sizeof(header));
+                if (!oldest || header.timestamp < oldest_timestamp) {
+                    oldest = slot;
+                    oldest_ring = i;
+                    oldest_timestamp = header.timestamp;
+                }
+            }
+            if (!oldest) {
+                break;
+            }
+            BinaryLogEntryHeader header;
+            memcpy(&header, oldest, sizeof(header));
+            if (header.size > FlightRing::kMaxPayload) {
+                header.size = 0;
+            }
+            WriteAll(fd, &header, sizeof(header));
+            WriteAll(fd, oldest + sizeof(header), header.size);
+            ++cursors[oldest_ring];
+        }
+    }
+
+private:
+    const FormatDescriptor* descriptors_;
+    std::atomic<const std::atomic<uint32_t>*> descriptor_count_;
+    std::atomic<FlightRing*> rings_[kMaxRings];
+    std::atomic<uint32_t> ring_count_;
+
+    char path_[260];
+    BinaryLogFileHeader file_header_;
+    std::atomic<bool> installed_;
+    std::atomic<bool> dumping_;
+};
+
+} // namespace logger
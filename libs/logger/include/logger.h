@@ -1,16 +1,168 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <stdint.h>
+
+#include "tsc_clock.h"
+
+#define LOG_LEVEL_INFO 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_ERROR 2
+#define LOG_LEVEL_OFF 3
+
+// Statements below LOG_COMPILE_LEVEL are removed by the compiler, their
+// arguments are never evaluated. Define it before including this header or
+// in the project settings.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Define LOG_ASYNC to hand the lines to the asynchronous backend, otherwise
+// they are written to the console streams directly.
+#ifndef LOG_ASYNC
 #define LOG_CONSOLE
+#endif
+
+namespace logger {
+
+// Statements below the runtime level are skipped before any formatting.
+inline std::atomic<int>& RuntimeLogLevel() {
+    static std::atomic<int> level(LOG_LEVEL_INFO);
+    return level;
+}
+
+inline void SetLogLevel(int level) {
+    RuntimeLogLevel().store(level, std::memory_order_relaxed);
+}
+
+inline bool IsLogLevelEnabled(int level) {
+    return level >= RuntimeLogLevel().load(std::memory_order_relaxed);
+}
+
+// Per call site state of the sampled and rate limited statements. It lives in
+// static storage and is zero initialized, so it needs no guard or lock.
+struct LogSiteState {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> suppressed;
+    std::atomic<int64_t> window_start_ns;
+    std::atomic<uint64_t> window_count;
+};
+
+// Decision for one occurrence, converts to true when the line is skipped.
+// Streaming it prefixes the line with the number of suppressed lines.
+class LogSiteGate {
+public:
+    // Logs the 1st, (n+1)th, (2n+1)th ... occurrence.
+    static LogSiteGate EveryN(LogSiteState& state, uint64_t n) {
+        const uint64_t count = state.count.fetch_add(1, std::memory_order_relaxed);
+        return Decide(state, n <= 1 || count % n == 0);
+    }
+
+    // Logs at most |per_second| occurrences in each one second window. The
+    // first call calibrates the TscClock unless TscClock::WarmUp() ran.
+    static LogSiteGate RateLimited(LogSiteState& state, uint64_t per_second) {
+        const int64_t now_ns = static_cast<int64_t>(TscClock::Instance().NowNanoseconds());
+        int64_t window_start_ns = state.window_start_ns.load(std::memory_order_relaxed);
+        if (now_ns - window_start_ns >= 1000000000 &&
+            state.window_start_ns.compare_exchange_strong(window_start_ns, now_ns,
+                std::memory_order_relaxed)) {
+            state.window_count.store(0, std::memory_order_relaxed);
+        }
+        const uint64_t count = state.window_count.fetch_add(1, std::memory_order_relaxed);
+        return Decide(state, count < per_second);
+    }
+
+    explicit operator bool() const { return skip_; }
+    uint64_t Suppressed() const { return suppressed_; }
+
+private:
+    LogSiteGate(bool skip, uint64_t suppressed) : skip_(skip), suppressed_(suppressed) {}
+
+    static LogSiteGate Decide(LogSiteState& state, bool log) {
+        if (!log) {
+            state.suppressed.fetch_add(1, std::memory_order_relaxed);
+            return LogSiteGate(true, 0);
+        }
+        return LogSiteGate(false, state.suppressed.exchange(0, std::memory_order_relaxed));
+    }
+
+private:
+    bool skip_;
+    uint64_t suppressed_;
+};
+
+inline std::ostream& operator<<(std::ostream& stream, const LogSiteGate& gate) {
+    if (gate.Suppressed() > 0) {
+        stream << "[" << gate.Suppressed() << " similar lines suppressed] ";
+    }
+    return stream;
+}
+
+} // namespace logger
+
+// The stream expression only lives in the else branch, so a disabled level
+// constructs no stream and evaluates none of the << operands. The empty if
+// branch keeps a following else bound to the caller's if.
+#define LOG_IF_ENABLED(level, stream)                                        \
+    if (!((level) >= LOG_COMPILE_LEVEL && logger::IsLogLevelEnabled(level))) \
+        {}                                                                   \
+    else                                                                     \
+        stream
+
+// The static state is declared in a lambda, each expansion has its own.
+#define LOG_SITE_STATE()                                                     \
+    ([]() -> logger::LogSiteState& {                                         \
+        static logger::LogSiteState state;                                   \
+        return state;                                                        \
+    }())
+
+// Sampled and rate limited statements, |log| is LOG_INFO, LOG_WARN or
+// LOG_ERROR, e.g. LOG_RATE_LIMITED(LOG_WARN, 10) << "Receive error";
+// The gate only runs when the level is enabled, so a disabled statement
+// neither counts nor takes the suppressed count of the next printed line.
+#define LOG_EVERY_N(log, n)                                                  \
+    LOG_GATED(log##_LEVEL, log##_STREAM,                                     \
+        logger::LogSiteGate::EveryN(LOG_SITE_STATE(), (n)))
+
+#define LOG_RATE_LIMITED(log, per_second)                                    \
+    LOG_GATED(log##_LEVEL, log##_STREAM,                                     \
+        logger::LogSiteGate::RateLimited(LOG_SITE_STATE(), (per_second)))
+
+#define LOG_GATED(level, stream, gate)                                       \
+    LOG_IF_ENABLED(level,                                                    \
+        if (logger::LogSiteGate _log_gate = gate)                            \
+            {}                                                               \
+        else                                                                 \
+            stream << _log_gate)
+
+#define LOG_INFO_LEVEL LOG_LEVEL_INFO
+#define LOG_WARN_LEVEL LOG_LEVEL_WARN
+#define LOG_ERROR_LEVEL LOG_LEVEL_ERROR
+
+#if defined(LOG_ASYNC)
+#include "async_logger.h"
 
-#ifdef LOG_CONSOLE
+#define LOG_INFO_STREAM logger::LogLine(logger::kLogInfo)
+#define LOG_WARN_STREAM logger::LogLine(logger::kLogWarn)
+#define LOG_ERROR_STREAM logger::LogLine(logger::kLogError)
+#define LOG_INFO LOG_IF_ENABLED(LOG_LEVEL_INFO, LOG_INFO_STREAM)
+#define LOG_WARN LOG_IF_ENABLED(LOG_LEVEL_WARN, LOG_WARN_STREAM)
+#define LOG_ERROR LOG_IF_ENABLED(LOG_LEVEL_ERROR, LOG_ERROR_STREAM)
+#define ENDLINE logger::endline
+#elif defined(LOG_CONSOLE)
 #include <iostream>
 
-#define LOG_INFO std::cout
-#define LOG_WARN std::cerr
-#define LOG_ERROR std::cerr
+#define LOG_INFO_STREAM std::cout
+#define LOG_WARN_STREAM std::cerr
+#define LOG_ERROR_STREAM std::cerr
+#define LOG_INFO LOG_IF_ENABLED(LOG_LEVEL_INFO, LOG_INFO_STREAM)
+#define LOG_WARN LOG_IF_ENABLED(LOG_LEVEL_WARN, LOG_WARN_STREAM)
+#define LOG_ERROR LOG_IF_ENABLED(LOG_LEVEL_ERROR, LOG_ERROR_STREAM)
 #define ENDLINE std::endl
 #else
 
 #define LOG_ENDLINE ""
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,386 @@
+#pragma once
+
+// Log file sink writing into pre-sized, memory mapped segments. A write
+// reserves its range by adding to the atomic tail of the current segment
+// and copies the line into the mapping, it never waits for the disk. A
+// background thread prepares the next segment, pre-faults the pages a
+// window ahead of the tail, rotates when the size or age limit is reached
+// and syncs, trims and closes the old segments. When no prepared segment is
+// ready the line is dropped.
+//
+// Segments are named <base_path>.<index>.log, e.g. detector.000001.log.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/interprocess/detail/os_file_functions.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "async_logger.h"
+
+namespace logger {
+
+struct MmapFileSinkOptions {
+    MmapFileSinkOptions()
+        : segment_size(64 * 1024 * 1024),
+        prefault_window(4 * 1024 * 1024),
+        max_segment_age(std::chrono::seconds(0)) {
+    }
+
+    std::string base_path;
+    size_t segment_size;
+    // Pages this far ahead of the tail are faulted in by the background
+    // thread, which runs every 10 ms, so a writer rarely takes a page fault.
+    size_t prefault_window;
+    // Zero disables the time based rotation.
+    std::chrono::seconds max_segment_age;
+};
+
+class MmapFileSink : public LogSink {
+public:
+    explicit MmapFileSink(const MmapFileSinkOptions& options)
+        : options_(options), current_(nullptr), spare_(nullptr), next_index_(1),
+        retire_stack_(nullptr), epoch_(0), stop_(false), dropped_(0) {
+        readers_[0] = 0;
+        readers_[1] = 0;
+    }
+
+    ~MmapFileSink() {
+        Close();
+    }
+
+    // Maps the first segment and starts the background thread.
+    bool Open() {
+        std::unique_ptr<Segment> segment = CreateSegment();
+        if (!segment) {
+            return false;
+        }
+        current_.store(segment.release());
+        stop_ = false;
+        background_ = std::thread(&MmapFileSink::Run, this);
+        return true;
+    }
+
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        condition_.notify_all();
+        if (background_.joinable()) {
+            background_.join();
+        }
+        Segment* current = current_.exchange(nullptr);
+        if (current) {
+            Seal(current, current->tail.load());
+            Retire(current);
+        }
+        Segment* spare = spare_.exchange(nullptr);
+        if (spare) {
+            // Never written, remove the file instead of leaving it empty.
+            const std::string path = spare->path;
+            delete spare;
+            std::remove(path.c_str());
+        }
+        FinishRetired(true);
+    }
+
+    bool Write(const char* data, size_t size) override {
+        // Keeps every segment this write may load alive, see FinishRetired().
+        const EpochScope epoch_scope(*this);
+        // The second attempt goes to the segment installed by a rotation.
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            Segment* segment = current_.load();
+            if (!segment) {
+                break;
+            }
+            segment->writers.fetch_add(1);
+            if (segment != current_.load()) {
+                segment->writers.fetch_sub(1);
+                continue;
+            }
+            const size_t offset = segment->tail.fetch_add(size);
+            if (offset + size <= segment->capacity) {
+                memcpy(segment->data + offset, data, size);
+                segment->writers.fetch_sub(1);
+                return true;
+            }
+            segment->writers.fetch_sub(1);
+            if (offset <= segment->capacity) {
+                // This write crossed the end of the segment.
+                Seal(segment, offset);
+                if (!Rotate(segment)) {
+                    break;
+                }
+            }
+        }
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint64_t DroppedCount() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Segment {
+        std::string path;
+        boost::interprocess::mapped_region region;
+        char* data;
+        size_t capacity;
+        std::atomic<size_t> tail;
+        std::atomic<size_t> sealed_size;
+        std::atomic<int> writers;
+        std::chrono::steady_clock::time_point created;
+        // The pages below are faulted in, only used by the background thread.
+        size_t prefaulted;
+        Segment* next_retired;
+    };
+
+    // A writer counts itself in the reader slot of the epoch it entered in.
+    // The recheck makes sure the epoch didn't advance before it was counted,
+    // otherwise a grace period could miss it.
+    class EpochScope {
+    public:
+        explicit EpochScope(MmapFileSink& sink) : sink_(sink) {
+            for (;;) {
+                const uint64_t epoch = sink_.epoch_.load();
+                slot_ = static_cast<size_t>(epoch & 1);
+                sink_.readers_[slot_].fetch_add(1);
+                if (sink_.epoch_.load() == epoch) {
+                    break;
+                }
+                sink_.readers_[slot_].fetch_sub(1);
+            }
+        }
+
+        ~EpochScope() {
+            sink_.readers_[slot_].fetch_sub(1);
+        }
+
+    private:
+        MmapFileSink& sink_;
+        size_t slot_;
+    };
+
+    static constexpr size_t kUnsealed = static_cast<size_t>(-1);
+    static constexpr size_t kPageSize = 4096;
+
+    // Faults |page| in writable without changing it, a writer may be copying
+    // into the same page. An atomic or with zero keeps a concurrent store.
+    static void TouchPage(char* page) {
+#if defined(_MSC_VER)
+        _InterlockedOr8(page, 0);
+#else
+        __atomic_fetch_or(page, 0, __ATOMIC_RELAXED);
+#endif
+    }
+
+    // Only the pages the writers will reach soon are faulted in, touching
+    // the whole segment would dirty all of it on disk.
+    void Prefault(Segment* segment) {
+        const size_t tail = segment->tail.load();
+        if (tail >= segment->capacity || segment->sealed_size.load() != kUnsealed) {
+            return;
+        }
+        const size_t end = std::min(segment->capacity, tail + options_.prefault_window);
+        for (; segment->prefaulted < end; segment->prefaulted += kPageSize) {
+            TouchPage(segment->data + segment->prefaulted);
+        }
+    }
+
+    std::unique_ptr<Segment> CreateSegment() {
+        namespace ipc = boost::interprocess;
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%06u.log", next_index_++);
+        const std::string path = options_.base_path + suffix;
+
+        ipc::file_handle_t handle = ipc::ipcdetail::create_or_open_file(
+            path.c_str(), ipc::read_write);
+        if (handle == ipc::ipcdetail::invalid_file()) {
+            return nullptr;
+        }
+        const bool sized = ipc::ipcdetail::truncate_file(handle, options_.segment_size);
+        ipc::ipcdetail::close_file(handle);
+        if (!sized) {
+            return nullptr;
+        }
+
+        std::unique_ptr<Segment> segment(new Segment());
+        try {
+            ipc::file_mapping mapping(path.c_str(), ipc::read_write);
+            ipc::mapped_region region(mapping, ipc::read_write, 0, options_.segment_size);
+            segment->region.swap(region);
+        }
+        catch (const ipc::interprocess_exception&) {
+            return nullptr;
+        }
+        segment->path = path;
+        segment->data = static_cast<char*>(segment->region.get_address());
+        segment->capacity = options_.segment_size;
+        segment->tail = 0;
+        segment->sealed_size = kUnsealed;
+        segment->writers = 0;
+        segment->created = std::chrono::steady_clock::now();
+        segment->prefaulted = 0;
+        Prefault(segment.get());
+        return segment;
+    }
+
+    // Records the used size, writes reserving beyond it are dropped.
+    static void Seal(Segment* segment, size_t used) {
+        size_t unsealed = kUnsealed;
+        segment->sealed_size.compare_exchange_strong(unsealed,
+            used < segment->capacity ? used : segment->capacity);
+    }
+
+    // Called by writers too, so it neither locks nor waits. Without a
+    // prepared segment the background thread rotates on its next round.
+    bool Rotate(Segment* full) {
+        Segment* next = spare_.exchange(nullptr);
+        if (!next) {
+            return false;
+        }
+        Segment* expected = full;
+        if (!current_.compare_exchange_strong(expected, next)) {
+            // Rotated by another thread meanwhile.
+            Segment* no_spare = nullptr;
+            if (!spare_.compare_exchange_strong(no_spare, next)) {
+                Seal(next, 0);
+                Retire(next);
+            }
+            return true;
+        }
+        Retire(full);
+        return true;
+    }
+
+    void Retire(Segment* segment) {
+        segment->next_retired = retire_stack_.load();
+        while (!retire_stack_.compare_exchange_weak(segment->next_retired, segment)) {
+        }
+    }
+
+    // Syncs and trims the retired segments nobody writes to any more, only
+    // called by the background thread or after it has stopped. A writer may
+    // still hold the pointer of a closed segment, so its object is deleted
+    // after a grace period: the epoch advances once the segment can't be
+    // loaded any more, and the writers of the previous epoch have left when
+    // its reader slot drains.
+    void FinishRetired(bool all) {
+        namespace ipc = boost::interprocess;
+        std::vector<Segment*> retired_now;
+        for (Segment* segment = retire_stack_.exchange(nullptr); segment;
+            segment = segment->next_retired) {
+            retired_now.push_back(segment);
+        }
+        retired_.insert(retired_.end(), retired_now.rbegin(), retired_now.rend());
+
+        for (auto iter = retired_.begin(); iter != retired_.end(); ++iter) {
+            Segment* segment = *iter;
+            if (!segment->data || (!all && segment->writers.load() != 0)) {
+                continue;
+            }
+            segment->region.flush(0, 0, false);
+            ipc::mapped_region().swap(segment->region);
+            segment->data = nullptr;
+            ipc::file_handle_t handle = ipc::ipcdetail::open_existing_file(
+                segment->path.c_str(), ipc::read_write);
+            if (handle != ipc::ipcdetail::invalid_file()) {
+                ipc::ipcdetail::truncate_file(handle, segment->sealed_size.load());
+                ipc::ipcdetail::close_file(handle);
+            }
+        }
+        while (!retired_.empty() && !retired_.front()->data) {
+            closed_.push_back(retired_.front());
+            retired_.pop_front();
+        }
+
+        if (!in_grace_period_.empty() && (all || readers_[(epoch_.load() - 1) & 1].load() == 0)) {
+            for (auto iter = in_grace_period_.begin(); iter != in_grace_period_.end(); ++iter) {
+                delete *iter;
+            }
+            in_grace_period_.clear();
+        }
+        if (all) {
+            for (auto iter = closed_.begin(); iter != closed_.end(); ++iter) {
+                delete *iter;
+            }
+            closed_.clear();
+        }
+        else if (in_grace_period_.empty() && !closed_.empty()) {
+            in_grace_period_.swap(closed_);
+            epoch_.fetch_add(1);
+        }
+    }
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            condition_.wait_for(lock, std::chrono::milliseconds(10));
+            lock.unlock();
+
+            if (!spare_.load()) {
+                std::unique_ptr<Segment> segment = CreateSegment();
+                if (segment) {
+                    spare_.store(segment.release());
+                }
+            }
+
+            Segment* current = current_.load();
+            const bool expired = options_.max_segment_age.count() > 0 &&
+                std::chrono::steady_clock::now() - current->created >= options_.max_segment_age;
+            if (expired && current->tail.load() > 0) {
+                // Later reservations start beyond the end and are redirected.
+                Seal(current, current->tail.fetch_add(current->capacity + 1));
+            }
+            if (current->sealed_size.load() != kUnsealed) {
+                Rotate(current);
+            }
+            else {
+                Prefault(current);
+            }
+            FinishRetired(false);
+
+            lock.lock();
+        }
+    }
+
+private:
+    MmapFileSinkOptions options_;
+    std::atomic<Segment*> current_;
+    std::atomic<Segment*> spare_;
+    unsigned int next_index_;
+
+    std::atomic<Segment*> retire_stack_;
+    std::deque<Segment*> retired_;
+    // Closed segments waiting for the next grace period, and the ones in it.
+    std::vector<Segment*> closed_;
+    std::vector<Segment*> in_grace_period_;
+    std::atomic<uint64_t> epoch_;
+    std::atomic<int> readers_[2];
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool stop_;
+    std::thread background_;
+    std::atomic<uint64_t> dropped_;
+};
+
+} // namespace logger
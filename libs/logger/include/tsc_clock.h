@@ -0,0 +1,232 @@
+#pragma once
+
+// Low overhead clock reading the time stamp counter. The counter frequency
+// is calibrated against the steady clock (CLOCK_MONOTONIC) on first use, see
+// WarmUp(), and recalibrated every second by a background thread, ticks are
+// converted to nanoseconds with fixed point math:
+//   ns = base_ns + (ticks - base_ticks) * multiplier >> kShift
+// The parameters are published with a sequence lock, so a reader never
+// waits. Without an invariant counter the ticks are steady clock
+// nanoseconds.
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define LOGGER_HAS_TSC
+#endif
+
+namespace logger {
+
+class TscClock {
+public:
+    // Never destroyed, the recalibration thread runs for the whole process.
+    static TscClock& Instance() {
+        static TscClock* instance = new TscClock();
+        return *instance;
+    }
+
+    // The first Instance() calibrates, which sleeps 10 ms. Components which
+    // read the clock on a latency sensitive path call this at construction,
+    // so no packet or log line pays for it.
+    static void WarmUp() {
+        Instance();
+    }
+
+    static uint64_t ReadTicks() {
+#ifdef LOGGER_HAS_TSC
+        if (UseTsc()) {
+            return __rdtsc();
+        }
+#endif
+        return SteadyNanoseconds();
+    }
+
+    // Nanoseconds on the steady clock's epoch.
+    uint64_t ToNanoseconds(uint64_t ticks) const {
+        Parameters parameters;
+        Load(parameters);
+        return Convert(parameters, ticks, parameters.base_ns);
+    }
+
+    // Nanoseconds since the unix epoch.
+    uint64_t ToRealtimeNanoseconds(uint64_t ticks) const {
+        Parameters parameters;
+        Load(parameters);
+        return Convert(parameters, ticks, parameters.base_realtime_ns);
+    }
+
+    uint64_t NowNanoseconds() const {
+        return ToNanoseconds(ReadTicks());
+    }
+
+    uint64_t NowRealtimeNanoseconds() const {
+        return ToRealtimeNanoseconds(ReadTicks());
+    }
+
+    double TicksPerNanosecond() const {
+        Parameters parameters;
+        Load(parameters);
+        return static_cast<double>(1 << kShift) / static_cast<double>(parameters.multiplier);
+    }
+
+private:
+    static constexpr int kShift = 24;
+    static constexpr uint64_t kShiftMask = (static_cast<uint64_t>(1) << kShift) - 1;
+
+    struct Parameters {
+        uint64_t base_ticks;
+        uint64_t base_ns;
+        uint64_t base_realtime_ns;
+        uint64_t multiplier;
+    };
+
+    struct Sample {
+        uint64_t ticks;
+        uint64_t ns;
+        uint64_t realtime_ns;
+    };
+
+    TscClock() : sequence_(0) {
+        const Sample first = TakeSample();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        first_sample_ = first;
+        Publish(first, TakeSample());
+        std::thread(&TscClock::Recalibrate, this).detach();
+    }
+
+    static uint64_t SteadyNanoseconds() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    static uint64_t RealtimeNanoseconds() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    static bool UseTsc() {
+        static const bool use_tsc = HasInvariantTsc();
+        return use_tsc;
+    }
+
+    static bool HasInvariantTsc() {
+#if defined(_MSC_VER) && defined(LOGGER_HAS_TSC)
+        int registers[4];
+        __cpuid(registers, 0x80000000);
+        if (static_cast<unsigned int>(registers[0]) < 0x80000007) {
+            return false;
+        }
+        __cpuid(registers, 0x80000007);
+        return (registers[3] & (1 << 8)) != 0;
+#elif defined(LOGGER_HAS_TSC)
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+            return false;
+        }
+        return (edx & (1 << 8)) != 0;
+#else
+        return false;
+#endif
+    }
+
+    // Brackets the clock reads with two counter reads and keeps the
+    // tightest of a few attempts.
+    static Sample TakeSample() {
+        Sample best = { 0, 0, 0 };
+        uint64_t best_window = ~static_cast<uint64_t>(0);
+        for (int i = 0; i < 5; ++i) {
+            const uint64_t before = ReadTicks();
+            const uint64_t ns = SteadyNanoseconds();
+            const uint64_t realtime_ns = RealtimeNanoseconds();
+            const uint64_t after = ReadTicks();
+            if (after - before < best_window) {
+                best_window = after - before;
+                best.ticks = before + (after - before) / 2;
+                best.ns = ns;
+                best.realtime_ns = realtime_ns;
+            }
+        }
+        return best;
+    }
+
+    static uint64_t Convert(const Parameters& parameters, uint64_t ticks, uint64_t base) {
+        // Split the delta so neither product overflows.
+        const uint64_t delta = ticks - parameters.base_ticks;
+        if (static_cast<int64_t>(delta) < 0) {
+            return base;
+        }
+        return base + (delta >> kShift) * parameters.multiplier +
+            (((delta & kShiftMask) * parameters.multiplier) >> kShift);
+    }
+
+    void Load(Parameters& parameters) const {
+        for (;;) {
+            const uint32_t sequence = sequence_.load(std::memory_order_acquire);
+            parameters.base_ticks = base_ticks_.load(std::memory_order_relaxed);
+            parameters.base_ns = base_ns_.load(std::memory_order_relaxed);
+            parameters.base_realtime_ns = base_realtime_ns_.load(std::memory_order_relaxed);
+            parameters.multiplier = multiplier_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((sequence & 1) == 0 && sequence == sequence_.load(std::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+
+    // The frequency is measured from |from| to |to|, the conversion is based
+    // at |to|. The new base never goes behind the previous conversion, so the
+    // clock stays monotonic.
+    void Publish(const Sample& from, const Sample& to) {
+        uint64_t multiplier = static_cast<uint64_t>(1) << kShift;
+        if (to.ticks > from.ticks && to.ns > from.ns) {
+            multiplier = static_cast<uint64_t>(static_cast<double>(to.ns - from.ns) /
+                static_cast<double>(to.ticks - from.ticks) * (1 << kShift));
+        }
+        uint64_t base_ns = to.ns;
+        const uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+        if (sequence != 0) {
+            Parameters current;
+            Load(current);
+            const uint64_t converted_ns = Convert(current, to.ticks, current.base_ns);
+            if (converted_ns > base_ns) {
+                base_ns = converted_ns;
+            }
+        }
+
+        sequence_.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        base_ticks_.store(to.ticks, std::memory_order_relaxed);
+        base_ns_.store(base_ns, std::memory_order_relaxed);
+        base_realtime_ns_.store(to.realtime_ns, std::memory_order_relaxed);
+        multiplier_.store(multiplier, std::memory_order_relaxed);
+        sequence_.store(sequence + 2, std::memory_order_release);
+    }
+
+    void Recalibrate() {
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            // The longer the interval, the more precise the frequency.
+            Publish(first_sample_, TakeSample());
+        }
+    }
+
+private:
+    std::atomic<uint32_t> sequence_;
+    std::atomic<uint64_t> base_ticks_;
+    std::atomic<uint64_t> base_ns_;
+    std::atomic<uint64_t> base_realtime_ns_;
+    std::atomic<uint64_t> multiplier_;
+    Sample first_sample_;
+};
+
+} // namespace logger
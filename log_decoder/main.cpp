@@ -0,0 +1,225 @@
+// Turns a binary log written by logger::BinaryLogger or dumped by
+// logger::FlightRecorder back into text.
+//   log_decoder <binary log file>
+
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "binary_log_format.h"
+
+namespace {
+    struct Descriptor {
+        uint32_t line;
+        uint8_t level;
+        std::string file;
+        std::string format;
+        std::string arg_types;
+    };
+
+    const char* LevelName(uint8_t level) {
+        static const char* names[] = { "INFO", "WARN", "ERROR" };
+        if (level == logger::kTraceLevel) {
+            return "TRACE";
+        }
+        return level < 3 ? names[level] : "?";
+    }
+
+    std::string ReadString(const char*& data, const char* end) {
+        const char* terminator = static_cast<const char*>(memchr(data, 0, end - data));
+        if (!terminator) {
+            terminator = end;
+        }
+        std::string value(data, terminator);
+        data = terminator < end ? terminator + 1 : end;
+        return value;
+    }
+
+    template <typename T>
+    bool ReadValue(const char*& data, const char* end, T& value) {
+        if (end - data < static_cast<ptrdiff_t>(sizeof(T))) {
+            return false;
+        }
+        memcpy(&value, data, sizeof(T));
+        data += sizeof(T);
+        return true;
+    }
+
+    // Formats the next argument of type |type|, returns false if the
+    // payload is too short.
+    bool FormatArg(char type, const char*& data, const char* end, std::string& out) {
+        switch (type) {
+        case 'b': {
+            uint8_t value;
+            if (!ReadValue(data, end, value)) return false;
+            out += value ? "true" : "false";
+            return true;
+        }
+        case 'c': {
+            char value;
+            if (!ReadValue(data, end, value)) return false;
+            out += value;
+            return true;
+        }
+        case 'i': {
+            int64_t value;
+            if (!ReadValue(data, end, value)) return false;
+            out += std::to_string(value);
+            return true;
+        }
+        case 'u': {
+            uint64_t value;
+            if (!ReadValue(data, end, value)) return false;
+            out += std::to_string(value);
+            return true;
+        }
+        case 'd': {
+            double value;
+            if (!ReadValue(data, end, value)) return false;
+            out += std::to_string(value);
+            return true;
+        }
+        case 'a': {
+            uint32_t value;
+            if (!ReadValue(data, end, value)) return false;
+            out += std::to_string(value >> 24) + "." + std::to_string((value >> 16) & 0xFF) +
+                "." + std::to_string((value >> 8) & 0xFF) + "." + std::to_string(value & 0xFF);
+            return true;
+        }
+        case 's': {
+            uint32_t length;
+            if (!ReadValue(data, end, length) || end - data < length) return false;
+            out.append(data, length);
+            data += length;
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    std::string FormatMessage(const Descriptor& descriptor, const char* data, const char* end) {
+        std::string message;
+        size_t arg = 0;
+        const std::string& format = descriptor.format;
+        for (size_t i = 0; i < format.size(); ++i) {
+            if (format[i] == '{' && i + 1 < format.size() && format[i + 1] == '}' &&
+                arg < descriptor.arg_types.size()) {
+                if (!FormatArg(descriptor.arg_types[arg++], data, end, message)) {
+                    message += "<truncated>";
+                    return message;
+                }
+                ++i;
+            }
+            else {
+                message += format[i];
+            }
+        }
+        return message;
+    }
+
+    std::string FormatTime(uint64_t realtime_ns) {
+        const time_t seconds = static_cast<time_t>(realtime_ns / 1000000000);
+        struct tm local_time;
+#ifdef _WIN32
+        localtime_s(&local_time, &seconds);
+#else
+        localtime_r(&seconds, &local_time);
+#endif
+        char date[32];
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &local_time);
+        char fraction[16];
+        snprintf(fraction, sizeof(fraction), ".%09llu",
+            static_cast<unsigned long long>(realtime_ns % 1000000000));
+        return std::string(date) + fraction;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: log_decoder <binary log file>" << std::endl;
+        return 1;
+    }
+
+    std::ifstream input(argv[1], std::ios::binary);
+    const std::vector<char> content((std::istreambuf_iterator<char>(input)),
+        std::istreambuf_iterator<char>());
+    logger::BinaryLogFileHeader file_header;
+    if (content.size() < sizeof(file_header)) {
+        std::cerr << "Invalid binary log: " << argv[1] << std::endl;
+        return 1;
+    }
+    memcpy(&file_header, content.data(), sizeof(file_header));
+    if (memcmp(file_header.magic, logger::kBinaryLogMagic, 4) != 0 ||
+        file_header.version != logger::kBinaryLogVersion) {
+        std::cerr << "Unsupported binary log: " << argv[1] << std::endl;
+        return 1;
+    }
+
+    const char* begin = content.data() + sizeof(file_header);
+    const char* end = content.data() + content.size();
+
+    // The descriptors may follow the entries using them, load them first.
+    std::map<uint32_t, Descriptor> descriptors;
+    for (const char* entry = begin; end - entry >= static_cast<ptrdiff_t>(
+        sizeof(logger::BinaryLogEntryHeader));) {
+        logger::BinaryLogEntryHeader header;
+        memcpy(&header, entry, sizeof(header));
+        const char* payload = entry + sizeof(header);
+        const char* payload_end = payload + header.size;
+        if (payload_end > end) {
+            break;
+        }
+        if (header.id == logger::kDescriptorEntryId) {
+            uint32_t id = 0;
+            Descriptor descriptor;
+            ReadValue(payload, payload_end, id);
+            ReadValue(payload, payload_end, descriptor.line);
+            ReadValue(payload, payload_end, descriptor.level);
+            descriptor.file = ReadString(payload, payload_end);
+            descriptor.format = ReadString(payload, payload_end);
+            descriptor.arg_types = ReadString(payload, payload_end);
+            descriptors[id] = descriptor;
+        }
+        entry = payload_end;
+    }
+
+    for (const char* entry = begin; end - entry >= static_cast<ptrdiff_t>(
+        sizeof(logger::BinaryLogEntryHeader));) {
+        logger::BinaryLogEntryHeader header;
+        memcpy(&header, entry, sizeof(header));
+        const char* payload = entry + sizeof(header);
+        const char* payload_end = payload + header.size;
+        if (payload_end > end) {
+            std::cerr << "Truncated entry at offset " << entry - content.data() << std::endl;
+            break;
+        }
+        entry = payload_end;
+        if (header.id == logger::kDescriptorEntryId) {
+            continue;
+        }
+
+        const double elapsed_ns = static_cast<double>(
+            static_cast<int64_t>(header.timestamp - file_header.base_timestamp)) /
+            file_header.timestamp_ticks_per_ns;
+        const uint64_t realtime_ns = file_header.base_realtime_ns +
+            static_cast<int64_t>(elapsed_ns);
+        auto iter = descriptors.find(header.id);
+        if (iter == descriptors.end()) {
+            std::cout << FormatTime(realtime_ns) << " ? unknown descriptor "
+                << header.id << std::endl;
+            continue;
+        }
+        const Descriptor& descriptor = iter->second;
+        std::cout << FormatTime(realtime_ns) << " " << LevelName(descriptor.level) << " "
+            << descriptor.file << ":" << descriptor.line << " "
+            << FormatMessage(descriptor, payload, payload_end) << std::endl;
+    }
+    return 0;
+}
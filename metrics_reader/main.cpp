@@ -0,0 +1,147 @@
+// Samples the metrics a detector process exports to shared memory.
+//   metrics_reader [--handlers] [segment name] [interval ms] [samples]
+// The defaults are ip_detector_metrics, 1000 ms and endless sampling.
+// --handlers prints the asio handler report of handler_tracking.h instead
+// of the raw metrics.
+
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "handler_tracking.h"
+#include "metrics_shm_format.h"
+
+namespace {
+    // Kinds as in MetricKind, metrics.h.
+    const char* KindName(uint32_t kind) {
+        static const char* names[] = { "counter", "gauge", "histogram" };
+        return kind < 3 ? names[kind] : "?";
+    }
+
+    struct Sample {
+        uint64_t publish_count;
+        uint64_t publish_realtime_ns;
+        uint32_t metric_count;
+        MetricsShmEntry entries[kMaxShmMetrics];
+    };
+
+    // Copies a consistent publication, retries while the exporter writes.
+    bool ReadSample(const MetricsShmSegment* segment, Sample& sample) {
+        if (memcmp(segment->magic, kMetricsShmMagic, sizeof(segment->magic)) != 0 ||
+            segment->version != kMetricsShmVersion ||
+            segment->entry_size != sizeof(MetricsShmEntry)) {
+            return false;
+        }
+        for (;;) {
+            const uint32_t sequence = segment->sequence.load(std::memory_order_acquire);
+            if (sequence & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            sample.publish_count = segment->publish_count;
+            sample.publish_realtime_ns = segment->publish_realtime_ns;
+            sample.metric_count = segment->metric_count;
+            if (sample.metric_count > kMaxShmMetrics) {
+                sample.metric_count = kMaxShmMetrics;
+            }
+            memcpy(sample.entries, segment->entries,
+                sample.metric_count * sizeof(MetricsShmEntry));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (segment->sequence.load(std::memory_order_relaxed) == sequence) {
+                return true;
+            }
+        }
+    }
+
+    void PrintSample(const Sample& sample) {
+        std::cout << "publication " << sample.publish_count << " at "
+            << sample.publish_realtime_ns << " ns" << std::endl;
+        for (uint32_t i = 0; i < sample.metric_count; ++i) {
+            const MetricsShmEntry& entry = sample.entries[i];
+            std::cout << "  " << KindName(entry.kind) << " " << entry.name;
+            if (entry.kind != 2) {
+                std::cout << " " << entry.value << std::endl;
+                continue;
+            }
+            std::cout << " count " << entry.count << " sum " << entry.sum << " buckets";
+            const uint32_t bound_count = entry.bound_count < kMaxShmBounds ?
+                entry.bound_count : kMaxShmBounds;
+            for (uint32_t j = 0; j < bound_count; ++j) {
+                std::cout << " <=" << entry.bounds[j] << ":" << entry.buckets[j];
+            }
+            std::cout << " >:" << entry.buckets[bound_count] << std::endl;
+        }
+    }
+
+    void PrintHandlerReport(const Sample& sample) {
+        std::vector<MetricSnapshot> snapshots(sample.metric_count);
+        for (uint32_t i = 0; i < sample.metric_count; ++i) {
+            const MetricsShmEntry& entry = sample.entries[i];
+            MetricSnapshot& snapshot = snapshots[i];
+            snapshot.name = entry.name;
+            snapshot.kind = static_cast<MetricKind>(entry.kind);
+            snapshot.value = entry.value;
+            snapshot.count = entry.count;
+            snapshot.sum = entry.sum;
+            if (snapshot.kind == kMetricHistogram) {
+                const uint32_t bound_count = entry.bound_count < kMaxShmBounds ?
+                    entry.bound_count : kMaxShmBounds;
+                snapshot.bounds.assign(entry.bounds, entry.bounds + bound_count);
+                snapshot.buckets.assign(entry.buckets, entry.buckets + bound_count + 1);
+            }
+        }
+        std::cout << "publication " << sample.publish_count << " at "
+            << sample.publish_realtime_ns << " ns" << std::endl
+            << FormatHandlerReport(snapshots) << std::flush;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const bool handler_report = argc > 1 && std::string(argv[1]) == "--handlers";
+    if (handler_report) {
+        --argc;
+        ++argv;
+    }
+    const std::string name = argc > 1 ? argv[1] : kDefaultMetricsShmName;
+    const int interval_ms = argc > 2 ? atoi(argv[2]) : 1000;
+    const long samples = argc > 3 ? atol(argv[3]) : 0;
+
+    namespace ipc = boost::interprocess;
+    ipc::mapped_region region;
+    try {
+        ipc::shared_memory_object shared_memory(ipc::open_only, name.c_str(), ipc::read_only);
+        ipc::mapped_region mapped(shared_memory, ipc::read_only, 0, sizeof(MetricsShmSegment));
+        region.swap(mapped);
+    }
+    catch (const ipc::interprocess_exception& e) {
+        std::cerr << "Open shared memory " << name << " failed: " << e.what() << std::endl;
+        return 1;
+    }
+    const MetricsShmSegment* segment =
+        static_cast<const MetricsShmSegment*>(region.get_address());
+
+    static Sample sample;
+    for (long i = 0; samples == 0 || i < samples; ++i) {
+        if (i > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+        }
+        if (!ReadSample(segment, sample)) {
+            std::cerr << "Unsupported metrics layout in " << name << std::endl;
+            return 1;
+        }
+        if (handler_report) {
+            PrintHandlerReport(sample);
+        }
+        else {
+            PrintSample(sample);
+        }
+    }
+    return 0;
+}